@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "activetiles.h"
+#include "matrix.h"
+#include "stencil.h"
+
+// Takes dimensions and the wake up threshold.
+// Splits the matrix into ACTIVE_TILE_ROWS x ACTIVE_TILE_COLS tiles.
+// Returns the tracker, basically a constructor.
+struct ActiveTiles *activetiles_init(int cols, int rows, float threshold)
+{
+    struct ActiveTiles *at = malloc(sizeof(*at));
+
+    at->tilesX = (cols + ACTIVE_TILE_COLS - 1) / ACTIVE_TILE_COLS;
+    at->tilesY = (rows + ACTIVE_TILE_ROWS - 1) / ACTIVE_TILE_ROWS;
+    at->threshold = threshold;
+    at->first = 1;
+    at->computed = 0;
+    at->skipped = 0;
+
+    int numTiles = at->tilesX * at->tilesY;
+    at->change = calloc(numTiles, sizeof(float));
+    at->nextChange = calloc(numTiles, sizeof(float));
+    at->synced = calloc(numTiles, sizeof(unsigned char));
+    at->list = malloc(numTiles * sizeof(int));
+    at->copyList = malloc(numTiles * sizeof(int));
+
+    return at;
+}
+
+// Takes the tracker, ADDRESS of both matrices, dimensions, stride, transfer rate,
+// temperature, whether the matrices are padded, thread count, heater spans, a CHANGE_* norm,
+// and the busy times to fill in (NULL for none).
+// Performs one time step like matrix_step_parallel, but only on tiles where something
+// around them changed by more than the threshold last step. A tile whose whole
+// neighborhood held still computes to exactly what it already is, so with a
+// threshold of 0 the result is identical to the full sweep.
+// Heater cells take their temperature as each tile is computed, so the change measured is
+// between two clamped matrices, and heater cells never keep their tile awake on their own.
+// Returns how much the matrix changed under the norm, 0 for CHANGE_NONE. Like the row
+// kernels, that is the current matrix against what the destination held, the change of the
+// step before this one, so --epsilon stops on the same step as the full sweep.
+float activetiles_step(struct ActiveTiles *at, float **matrix, float **tmpMatrix, int cols, int rows, int stride,
+                       float k, float base, int padded, int numThreads, struct HeaterSpans *spans, int norm,
+                       struct StepOutputs *out)
+{
+    double *busy = out ? out->busy : NULL;
+    float *curMatrix = *matrix;
+    float *newMatrix = *tmpMatrix;
+    int numTiles = at->tilesX * at->tilesY;
+    int count = 0, copyCount = 0;
+
+    // A tile is awake if it or any of its 8 neighbors changed enough last step.
+    // Tiles falling asleep copy themselves over once, so both matrices agree and
+    // skipping them from then on leaves nothing stale behind in either one.
+    for (int ty = 0; ty < at->tilesY; ty++)
+    {
+        for (int tx = 0; tx < at->tilesX; tx++)
+        {
+            int t = tx + (ty * at->tilesX);
+            int wake = at->first;
+
+            for (int dy = -1; dy <= 1 && !wake; dy++)
+            {
+                for (int dx = -1; dx <= 1 && !wake; dx++)
+                {
+                    int nx = tx + dx;
+                    int ny = ty + dy;
+                    if (nx >= 0 && nx < at->tilesX && ny >= 0 && ny < at->tilesY &&
+                        at->change[nx + (ny * at->tilesX)] > at->threshold)
+                    {
+                        wake = 1;
+                    }
+                }
+            }
+
+            at->nextChange[t] = 0;
+            if (wake)
+            {
+                at->list[count++] = t;
+                at->synced[t] = 0;
+            }
+            else if (!at->synced[t])
+            {
+                at->copyList[copyCount++] = t;
+                at->synced[t] = 1;
+            }
+        }
+    }
+    at->first = 0;
+    at->computed += count;
+    at->skipped += numTiles - count;
+
+    stencil_init();
+
+    float maxChange = 0;
+    double sqChange = 0;
+
+    #pragma omp parallel num_threads(numThreads) reduction(max:maxChange) reduction(+:sqChange)
+    {
+        double busyStart = busy ? omp_get_wtime() : 0;
+
+        // tiles on the edge of a packed matrix cost more, dynamic evens that out
+        #pragma omp for schedule(dynamic) nowait
+        for (int n = 0; n < count; n++)
+        {
+            int t = at->list[n];
+            int rowStart = (t / at->tilesX) * ACTIVE_TILE_ROWS;
+            int colStart = (t % at->tilesX) * ACTIVE_TILE_COLS;
+            int rowEnd = rowStart + ACTIVE_TILE_ROWS < rows ? rowStart + ACTIVE_TILE_ROWS : rows;
+            int colEnd = colStart + ACTIVE_TILE_COLS < cols ? colStart + ACTIVE_TILE_COLS : cols;
+
+            matrix_step_block(curMatrix, newMatrix, cols, rows, stride, k, base, padded,
+                              rowStart, rowEnd, colStart, colEnd, spans,
+                              norm != CHANGE_NONE ? &maxChange : NULL, &sqChange);
+
+            // This step's own change decides who wakes next step. The tile was just
+            // written, so this rescan runs out of cache.
+            float tileMax = 0;
+            for (int i = rowStart; i < rowEnd; i++)
+            {
+                for (int j = colStart; j < colEnd; j++)
+                {
+                    float diff = fabsf(newMatrix[j + (i * stride)] - curMatrix[j + (i * stride)]);
+                    tileMax = diff > tileMax ? diff : tileMax;
+                }
+            }
+
+            at->nextChange[t] = tileMax;
+        }
+
+        // no barrier after, the end of the parallel region is one
+        #pragma omp for schedule(static) nowait
+        for (int n = 0; n < copyCount; n++)
+        {
+            int t = at->copyList[n];
+            int rowStart = (t / at->tilesX) * ACTIVE_TILE_ROWS;
+            int colStart = (t % at->tilesX) * ACTIVE_TILE_COLS;
+            int rowEnd = rowStart + ACTIVE_TILE_ROWS < rows ? rowStart + ACTIVE_TILE_ROWS : rows;
+            int colEnd = colStart + ACTIVE_TILE_COLS < cols ? colStart + ACTIVE_TILE_COLS : cols;
+
+            for (int i = rowStart; i < rowEnd; i++)
+            {
+                // the copy overwrites the previous matrix, which the full sweep would have measured against
+                for (int j = colStart; j < colEnd && norm != CHANGE_NONE; j++)
+                {
+                    float diff = fabsf(curMatrix[j + (i * stride)] - newMatrix[j + (i * stride)]);
+                    maxChange = diff > maxChange ? diff : maxChange;
+                    sqChange += diff * diff;
+                }
+                memcpy(&newMatrix[colStart + (i * stride)], &curMatrix[colStart + (i * stride)],
+                       (colEnd - colStart) * sizeof(float));
+            }
+        }
+
+        if (busy)
+            busy[omp_get_thread_num()] += omp_get_wtime() - busyStart;
+    }
+
+    float *tmp = at->change;
+    at->change = at->nextChange;
+    at->nextChange = tmp;
+
+    tmp = *matrix;
+    *matrix = *tmpMatrix;
+    *tmpMatrix = tmp;
+
+    return matrix_change(norm, maxChange, sqChange);
+}
+
+void activetiles_free(struct ActiveTiles *at)
+{
+    free(at->change);
+    free(at->nextChange);
+    free(at->synced);
+    free(at->list);
+    free(at->copyList);
+    free(at);
+}
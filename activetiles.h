@@ -0,0 +1,33 @@
+#ifndef ACTIVE_TILES_H
+#define ACTIVE_TILES_H
+
+#include "heater.h"
+#include "matrix.h"
+
+#define ACTIVE_TILE_ROWS 64
+#define ACTIVE_TILE_COLS 64
+
+// Tracks which tiles of the matrix are still changing, so steps can skip the rest.
+struct ActiveTiles
+{
+    int tilesX, tilesY;
+    float threshold;       // a tile sleeps once every tile around it changed by this much or less
+
+    float *change;         // largest change of each tile over the last step
+    float *nextChange;     // filled in by the step being run
+    unsigned char *synced; // both matrices hold identical values for this tile
+    int first;             // nothing is known before the first step, so everything runs
+
+    int *list;             // tiles to compute this step
+    int *copyList;         // tiles falling asleep this step, copied instead of computed
+
+    long long computed;    // tile updates run, for the summary
+    long long skipped;     // tile updates skipped
+};
+
+struct ActiveTiles *activetiles_init(int, int, float);
+float activetiles_step(struct ActiveTiles *, float **, float **, int, int, int, float, float, int, int,
+                       struct HeaterSpans *, int, struct StepOutputs *);
+void activetiles_free(struct ActiveTiles *);
+
+#endif
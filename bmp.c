@@ -1,53 +1,91 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "bmp.h"
 
 #define BYTES_PER_PIXEL 3 // rgb, no alpha or depth
 #define HEADER_SIZE 14
 #define INFO_SIZE 40
 
-unsigned char *bmp_generate_header(int, int, int);
-unsigned char *bmp_generate_info(int, int);
+void bmp_generate_header(unsigned char *, int, int);
+void bmp_generate_info(unsigned char *, int, int);
 
+// Takes a packed, top-down bgr image, its dimensions, and the file name.
+// Images drawn straight into the file (generate_bmp_float) never need this,
+// it is for ones that already exist in memory. Rows are copied into the
+// mapped file bottom-up, padding and all, with no stdio in between.
 void bmp_generate_image(unsigned char *img, int height, int width, char *fileName)
 {
+    size_t mapSize;
+    unsigned char *file = bmp_map_image(height, width, fileName, &mapSize);
+    if (!file)
+        return;
+
     int byteWidth = width * BYTES_PER_PIXEL;
+    int rowBytes = bmp_row_bytes(width);
 
-    unsigned char padding[] = {0, 0, 0};
-    int paddingSize = (4 - (byteWidth) % 4) % 4; // how many padding bytes to add
+    for (int i = height - 1; i >= 0; i--)
+    {
+        unsigned char *row = file + BMP_HEADER_SIZE + ((size_t)(height - 1 - i) * rowBytes);
+        memcpy(row, &img[(size_t)i * byteWidth], byteWidth);
+    }
 
-    FILE *imgFile = fopen(fileName, "wb");
+    bmp_unmap_image(file, mapSize);
+}
 
-    unsigned char *header = bmp_generate_header(height, width, paddingSize);
-    fwrite(header, 1, HEADER_SIZE, imgFile);
+// Takes image dimensions, the file name, and where to put the mapping size.
+// Creates the file at its final size with the headers already written, and maps it,
+// so the pixel array at BMP_HEADER_SIZE can be drawn into directly. Rows are stored
+// bottom-up, bmp_row_bytes apart, and their padding is already zero.
+// Returns the mapping, or NULL if the file could not be made. Release with bmp_unmap_image.
+unsigned char *bmp_map_image(int height, int width, char *fileName, size_t *mapSize)
+{
+    size_t size = BMP_HEADER_SIZE + ((size_t)bmp_row_bytes(width) * height);
 
-    unsigned char *info = bmp_generate_info(height, width);
-    fwrite(info, 1, INFO_SIZE, imgFile);
+    int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
 
-    for (int i = height - 1; i >= 0; i--)
+    if (ftruncate(fd, size))
     {
-        for (int j = 0; j < width; j++)
-        {
-            int start_index = (j + (i * width)) * BYTES_PER_PIXEL;
-            unsigned char color[] = {img[start_index + 0], img[start_index + 1], img[start_index + 2]};
-;
-            fwrite(color, 1, BYTES_PER_PIXEL, imgFile);
-        }
-        fwrite(padding, 1, paddingSize, imgFile);
+        close(fd);
+        return NULL;
     }
 
-    free(header);
-    free(info);
-    fclose(imgFile);
+    unsigned char *file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (file == MAP_FAILED)
+        return NULL;
+
+    unsigned char header[BMP_HEADER_SIZE] = {0};
+    bmp_generate_header(header, height, width);
+    bmp_generate_info(&header[HEADER_SIZE], height, width);
+    memcpy(file, header, BMP_HEADER_SIZE);
+
+    *mapSize = size;
+    return file;
 }
 
-unsigned char *bmp_generate_header(int height, int width, int padding)
+// Takes the mapping and size from bmp_map_image, and finishes the file.
+void bmp_unmap_image(unsigned char *file, size_t mapSize)
 {
-    int size = HEADER_SIZE + INFO_SIZE + width * height * BYTES_PER_PIXEL + padding * height;
+    munmap(file, mapSize);
+}
+
+// Takes an image width, returns the bytes per row in the file, padded to a multiple of 4.
+int bmp_row_bytes(int width)
+{
+    int byteWidth = width * BYTES_PER_PIXEL;
+    return byteWidth + ((4 - (byteWidth) % 4) % 4);
+}
 
-    unsigned char *header = (unsigned char *)malloc(sizeof(char) * HEADER_SIZE);
-    for (int i = 0; i < HEADER_SIZE; i++)
-        header[i] = 0;
+// Fills in the 14 byte file header, header must already be zeroed.
+void bmp_generate_header(unsigned char *header, int height, int width)
+{
+    int size = BMP_HEADER_SIZE + (bmp_row_bytes(width) * height);
 
     header[0]  = (unsigned char)'B';
     header[1]  = (unsigned char)'M';
@@ -56,16 +94,11 @@ unsigned char *bmp_generate_header(int height, int width, int padding)
     header[4]  = (unsigned char)(size >> 16);
     header[5]  = (unsigned char)(size >> 24);
     header[10] = (unsigned char)(HEADER_SIZE + INFO_SIZE);
-    
-    return header;
 }
 
-unsigned char *bmp_generate_info(int height, int width)
+// Fills in the 40 byte info header, info must already be zeroed.
+void bmp_generate_info(unsigned char *info, int height, int width)
 {
-    unsigned char *info = (unsigned char *)malloc(sizeof(char) * INFO_SIZE);
-    for (int i = 0; i < INFO_SIZE; i++)
-        info[i] = 0;
-
     info[0]  = (unsigned char)INFO_SIZE;
     info[4]  = (unsigned char)(width);
     info[5]  = (unsigned char)(width >> 8);
@@ -77,6 +110,4 @@ unsigned char *bmp_generate_info(int height, int width)
     info[11] = (unsigned char)(height >> 24);
     info[12] = 1;
     info[14] = (unsigned char)(BYTES_PER_PIXEL * 8);
-
-    return info;
 }
\ No newline at end of file
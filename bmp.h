@@ -1,6 +1,13 @@
 #ifndef BMP_H
 #define BMP_H
 
+#include <stddef.h>
+
+#define BMP_HEADER_SIZE 54 // file header and info header, the pixel array starts here
+
 void bmp_generate_image(unsigned char *, int, int, char *);
+unsigned char *bmp_map_image(int, int, char *, size_t *);
+void bmp_unmap_image(unsigned char *, size_t);
+int bmp_row_bytes(int);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gif.h"
+
+#define LZW_MIN_CODE_SIZE 8  // 256 colors
+#define LZW_MAX_CODES 4096   // 12 bit codes, the most GIF allows
+#define LZW_HASH_SIZE 8192   // power of two, twice the codes so probes stay short
+
+void gif_put_short(FILE *, int);
+
+// Takes an output file name, image size, the palette (GIF_COLORS rgb triples),
+// and how long each frame is shown in hundredths of a second.
+// Writes the header, palette, and a loop-forever extension, frames follow with gif_frame.
+// Returns the writer, or NULL if the file could not be opened.
+struct GifWriter *gif_open(char *fileName, int width, int height, unsigned char *palette, int delay)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (!file)
+        return NULL;
+
+    struct GifWriter *gw = malloc(sizeof(*gw));
+    gw->file = file;
+    gw->width = width;
+    gw->height = height;
+    gw->delay = delay;
+
+    // worst case is one 12 bit code per pixel, plus a clear code every LZW_MAX_CODES
+    gw->blocks = malloc(((size_t)width * height * 2) + 64);
+    gw->hashKey = malloc(LZW_HASH_SIZE * sizeof(int));
+    gw->hashCode = malloc(LZW_HASH_SIZE * sizeof(short));
+
+    fwrite("GIF89a", 1, 6, file);
+    gif_put_short(file, width);
+    gif_put_short(file, height);
+    fputc(0xF7, file); // global palette of 256 colors, 8 bits per channel
+    fputc(0, file);    // background color
+    fputc(0, file);    // square pixels
+    fwrite(palette, 1, GIF_COLORS * 3, file);
+
+    // application extension telling viewers to loop forever
+    fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, file);
+
+    return gw;
+}
+
+// Takes the writer and width * height palette indices, top row first.
+// Compresses them with LZW and appends them as the next frame.
+void gif_frame(struct GifWriter *gw, unsigned char *pixels)
+{
+    FILE *file = gw->file;
+
+    // graphic control extension, only there for the frame delay
+    fwrite("\x21\xF9\x04\x00", 1, 4, file);
+    gif_put_short(file, gw->delay);
+    fwrite("\x00\x00", 1, 2, file);
+
+    // image descriptor, the whole canvas, no local palette
+    fputc(0x2C, file);
+    gif_put_short(file, 0);
+    gif_put_short(file, 0);
+    gif_put_short(file, gw->width);
+    gif_put_short(file, gw->height);
+    fputc(0, file);
+    fputc(LZW_MIN_CODE_SIZE, file);
+
+    const int clearCode = 1 << LZW_MIN_CODE_SIZE;
+    int nextCode = clearCode + 2;
+    int codeSize = LZW_MIN_CODE_SIZE + 1;
+
+    // codes are packed least significant bit first
+    size_t len = 0;
+    unsigned int bits = 0;
+    int bitCount = 0;
+
+    #define LZW_PUT(code)                                    \
+        do                                                   \
+        {                                                    \
+            bits |= (unsigned int)(code) << bitCount;        \
+            bitCount += codeSize;                            \
+            while (bitCount >= 8)                            \
+            {                                                \
+                gw->blocks[len++] = bits & 0xFF;             \
+                bits >>= 8;                                  \
+                bitCount -= 8;                               \
+            }                                                \
+        } while (0)
+
+    memset(gw->hashKey, 0, LZW_HASH_SIZE * sizeof(int));
+    LZW_PUT(clearCode);
+
+    size_t count = (size_t)gw->width * gw->height;
+    int prefix = pixels[0];
+    for (size_t p = 1; p < count; p++)
+    {
+        int key = ((prefix << 8) | pixels[p]) + 1;
+        int slot = (key * 2654435761u) >> 19 & (LZW_HASH_SIZE - 1);
+        while (gw->hashKey[slot] && gw->hashKey[slot] != key)
+            slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+
+        if (gw->hashKey[slot])
+        {
+            prefix = gw->hashCode[slot]; // string is known, keep extending it
+            continue;
+        }
+
+        LZW_PUT(prefix);
+        prefix = pixels[p];
+
+        if (nextCode < LZW_MAX_CODES)
+        {
+            gw->hashKey[slot] = key;
+            gw->hashCode[slot] = nextCode;
+
+            // the decoder widens one code later than it adds the entry
+            if (nextCode++ == (1 << codeSize))
+                codeSize++;
+        }
+        else
+        {
+            // dictionary is full, start over
+            LZW_PUT(clearCode);
+            memset(gw->hashKey, 0, LZW_HASH_SIZE * sizeof(int));
+            nextCode = clearCode + 2;
+            codeSize = LZW_MIN_CODE_SIZE + 1;
+        }
+    }
+    LZW_PUT(prefix);
+
+    // the decoder adds an entry for that last code too, and may widen before the end code
+    if (nextCode < LZW_MAX_CODES && nextCode == (1 << codeSize))
+        codeSize++;
+    LZW_PUT(clearCode + 1); // end of information
+    if (bitCount > 0)
+        gw->blocks[len++] = bits & 0xFF;
+
+    #undef LZW_PUT
+
+    for (size_t done = 0; done < len; done += 255)
+    {
+        int block = len - done < 255 ? len - done : 255;
+        fputc(block, file);
+        fwrite(&gw->blocks[done], 1, block, file);
+    }
+    fputc(0, file); // no more blocks in this frame
+}
+
+// Takes the writer, ends the file and frees it.
+// Returns 0 on success, 1 if anything failed to write.
+int gif_close(struct GifWriter *gw)
+{
+    fputc(0x3B, gw->file); // trailer
+    int failed = ferror(gw->file) != 0;
+    failed |= fclose(gw->file) != 0;
+
+    free(gw->blocks);
+    free(gw->hashKey);
+    free(gw->hashCode);
+    free(gw);
+
+    return failed;
+}
+
+// Writes a little endian 16 bit number, the only multi-byte type in a GIF.
+void gif_put_short(FILE *file, int value)
+{
+    fputc(value & 0xFF, file);
+    fputc((value >> 8) & 0xFF, file);
+}
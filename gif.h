@@ -0,0 +1,25 @@
+#ifndef GIF_H
+#define GIF_H
+
+#include <stdio.h>
+
+#define GIF_COLORS 256 // palette entries, every frame pixel is one byte
+
+// Animated GIF being written one frame at a time, every frame the full image size
+// and sharing one global palette.
+struct GifWriter
+{
+    FILE *file;
+    int width, height;
+    int delay; // hundredths of a second each frame is shown
+
+    unsigned char *blocks; // LZW output waiting to be split into 255 byte sub-blocks
+    int *hashKey;          // LZW dictionary, (prefix << 8 | byte) + 1, 0 = empty
+    short *hashCode;
+};
+
+struct GifWriter *gif_open(char *, int, int, unsigned char *, int);
+void gif_frame(struct GifWriter *, unsigned char *);
+int gif_close(struct GifWriter *);
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gridfile.h"
+
+_Static_assert(sizeof(struct GridFileHeader) == GRIDFILE_HEADER_SIZE, "grid file header must stay 64 bytes");
+
+// Takes matrix, dimensions, row stride, run parameters, and an output file name.
+// Sizes the file up front and maps it, so the header and every row are copied
+// straight into the page cache, with no formatting and no intermediate buffer.
+// Padded matrices lose their padding on the way, cells are always packed.
+// Returns 0 on success, 1 if the file could not be written.
+int gridfile_write(float *matrix, int cols, int rows, int stride, float base, float k, int timesteps, char *fileName)
+{
+    size_t rowBytes = (size_t)cols * sizeof(float);
+    size_t total = GRIDFILE_HEADER_SIZE + (rowBytes * rows);
+
+    int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 1;
+
+    if (ftruncate(fd, total))
+    {
+        close(fd);
+        return 1;
+    }
+
+    char *map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED)
+        return 1;
+
+    struct GridFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRIDFILE_MAGIC, sizeof(header.magic));
+    header.version = GRIDFILE_VERSION;
+    header.headerSize = GRIDFILE_HEADER_SIZE;
+    header.rows = rows;
+    header.cols = cols;
+    header.dtype = GRIDFILE_FLOAT32;
+    header.timesteps = timesteps;
+    header.baseTemp = base;
+    header.k = k;
+    memcpy(map, &header, sizeof(header));
+
+    // one copy of the whole thing when there is no padding to skip
+    if (stride == cols)
+    {
+        memcpy(map + GRIDFILE_HEADER_SIZE, matrix, rowBytes * rows);
+    }
+    else
+    {
+        for (int i = 0; i < rows; i++)
+        {
+            memcpy(map + GRIDFILE_HEADER_SIZE + (rowBytes * i), &matrix[(size_t)i * stride], rowBytes);
+        }
+    }
+
+    munmap(map, total);
+    return 0;
+}
+
+// Takes the same arguments as gridfile_write.
+// Writes the grid to fileName.tmp, flushes it to disk, then renames it over fileName
+// and flushes the directory, so fileName always holds a whole grid, the last one or
+// the one before, even if the run or the machine dies halfway through writing.
+// Returns 0 on success, 1 if the file could not be written.
+int gridfile_checkpoint(float *matrix, int cols, int rows, int stride, float base, float k, int timesteps,
+                        char *fileName)
+{
+    char *tmpName = (char *)malloc(strlen(fileName) + 5);
+    strcpy(tmpName, fileName);
+    strcat(tmpName, ".tmp");
+
+    int failed = gridfile_write(matrix, cols, rows, stride, base, k, timesteps, tmpName);
+
+    // the mapping is gone, but syncing any descriptor flushes the file's dirty pages
+    if (!failed)
+    {
+        int fd = open(tmpName, O_RDONLY);
+        failed = fd < 0 || fsync(fd);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    if (!failed)
+        failed = rename(tmpName, fileName) != 0;
+    else
+        unlink(tmpName);
+
+    // the rename only lives in the directory until the directory itself is flushed
+    if (!failed)
+    {
+        char *slash = strrchr(tmpName, '/');
+        if (slash)
+            slash[slash == tmpName] = '\0'; // keeps the / of a file in the root
+        int dirFd = open(slash ? tmpName : ".", O_RDONLY | O_DIRECTORY);
+        failed = dirFd < 0 || fsync(dirFd);
+        if (dirFd >= 0)
+            close(dirFd);
+    }
+
+    free(tmpName);
+    return failed;
+}
+
+// Takes a grid file name, and where to put the header pointer and mapping size.
+// Maps the file read-only and checks that it is a grid file this code understands.
+// Returns a pointer to cell 0,0 (cell r,c is at [c + r * cols]), or NULL if the
+// file is missing, truncated, or not a grid file. Release with gridfile_unmap.
+float *gridfile_map(char *fileName, struct GridFileHeader **header, size_t *mapSize)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) || (size_t)info.st_size < GRIDFILE_HEADER_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = info.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    struct GridFileHeader *h = (struct GridFileHeader *)map;
+    if (memcmp(h->magic, GRIDFILE_MAGIC, sizeof(h->magic)) || h->version != GRIDFILE_VERSION ||
+        h->dtype != GRIDFILE_FLOAT32 || h->headerSize < GRIDFILE_HEADER_SIZE ||
+        size < h->headerSize + ((size_t)h->rows * h->cols * sizeof(float)))
+    {
+        munmap(map, size);
+        return NULL;
+    }
+
+    *header = h;
+    *mapSize = size;
+    return (float *)(map + h->headerSize);
+}
+
+// Takes the header and size from gridfile_map, and unmaps the file.
+void gridfile_unmap(struct GridFileHeader *header, size_t mapSize)
+{
+    munmap(header, mapSize);
+}
@@ -0,0 +1,34 @@
+#ifndef GRIDFILE_H
+#define GRIDFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GRIDFILE_MAGIC "HEATGRID"
+#define GRIDFILE_VERSION 1
+#define GRIDFILE_HEADER_SIZE 64 // cells start here, so they are 64 byte aligned in a mapping
+#define GRIDFILE_FLOAT32 1      // dtype of the cells, little endian IEEE floats
+
+// Binary grid file, this header followed by rows*cols cells in row order, no padding.
+// Fixed width fields, little endian, so a reader can mmap the file, check magic
+// and version, and index cells at (char *)header + headerSize with no parsing.
+struct GridFileHeader
+{
+    char magic[8];       // "HEATGRID", no terminator
+    uint32_t version;    // GRIDFILE_VERSION
+    uint32_t headerSize; // bytes before the first cell
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t dtype;      // GRIDFILE_FLOAT32
+    uint32_t timesteps;  // timesteps the grid was simulated for
+    float baseTemp;
+    float k;
+    char reserved[24];   // zeroed, room to grow without moving the cells
+};
+
+int gridfile_write(float *, int, int, int, float, float, int, char *);
+int gridfile_checkpoint(float *, int, int, int, float, float, int, char *);
+float *gridfile_map(char *, struct GridFileHeader **, size_t *);
+void gridfile_unmap(struct GridFileHeader *, size_t);
+
+#endif
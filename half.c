@@ -0,0 +1,256 @@
+#include <string.h>
+#include "half.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HALF_X86
+#include <immintrin.h>
+#endif
+
+// Conversions round to nearest, ties to even, the same as the F16C instructions,
+// so whether those are there or not never changes what is stored.
+
+#ifdef HALF_X86
+void half_from_float_f16c(uint16_t *, const float *, int);
+void half_to_float_f16c(float *, const uint16_t *, int);
+void half_from_float_bf16_avx2(uint16_t *, const float *, int);
+void half_to_float_bf16_avx2(float *, const uint16_t *, int);
+#endif
+
+int halfF16C = -1; // -1 until half_init has looked
+int halfAVX2 = -1;
+
+// Checks whether the running CPU has F16C, and AVX2 for bfloat16.
+// Called from the serial part of every step function before threads start,
+// like stencil_init.
+void half_init(void)
+{
+    if (halfF16C >= 0)
+        return;
+
+    halfF16C = 0;
+    halfAVX2 = 0;
+#ifdef HALF_X86
+    __builtin_cpu_init();
+    halfF16C = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    halfAVX2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+// Takes a STORAGE_* format, returns the name of the conversion half_init picked for it.
+const char *half_isa(int format)
+{
+    half_init();
+    if (format == STORAGE_F16)
+        return halfF16C ? "f16c" : "scalar";
+    return halfAVX2 ? "avx2" : "scalar";
+}
+
+// Takes an output array, n floats, and a STORAGE_* format (F16 or BF16).
+// Rounds each float to 16 bits.
+void half_from_float(uint16_t *out, const float *in, int n, int format)
+{
+#ifdef HALF_X86
+    if (format == STORAGE_F16 && halfF16C > 0)
+    {
+        half_from_float_f16c(out, in, n);
+        return;
+    }
+    if (format == STORAGE_BF16 && halfAVX2 > 0)
+    {
+        half_from_float_bf16_avx2(out, in, n);
+        return;
+    }
+#endif
+
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = half_from_float_one(in[i], format);
+    }
+}
+
+// Takes an output array, n 16 bit values, and a STORAGE_* format (F16 or BF16).
+// Widens each back to a float, which is always exact.
+void half_to_float(float *out, const uint16_t *in, int n, int format)
+{
+#ifdef HALF_X86
+    if (format == STORAGE_F16 && halfF16C > 0)
+    {
+        half_to_float_f16c(out, in, n);
+        return;
+    }
+    if (format == STORAGE_BF16 && halfAVX2 > 0)
+    {
+        half_to_float_bf16_avx2(out, in, n);
+        return;
+    }
+#endif
+
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = half_to_float_one(in[i], format);
+    }
+}
+
+// Takes a float and a STORAGE_* format.
+// Returns it rounded to 16 bits. Too big for a half float becomes infinity.
+uint16_t half_from_float_one(float value, int format)
+{
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+
+    if (format == STORAGE_BF16)
+    {
+        if ((x & 0x7fffffff) > 0x7f800000)
+            return (x >> 16) | 0x40; // keep NaNs NaN
+        return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+    }
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mag = x & 0x7fffffff;
+
+    if (mag >= 0x7f800000)
+        return sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0);
+    if (mag >= 0x477ff000) // 65520 and up round past the largest half, 65504
+        return sign | 0x7c00;
+
+    if (mag < 0x38800000)
+    {
+        // below the smallest normal half, 2^-14, the result counts steps of 2^-24
+        if (mag < 0x33000000) // 2^-25 and under round to 0
+            return sign;
+
+        uint32_t mantissa = (mag & 0x7fffff) | 0x800000;
+        int shift = 126 - (int)(mag >> 23);
+        uint32_t result = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (remainder > half || (remainder == half && (result & 1)))
+            result++;
+
+        return sign | result;
+    }
+
+    // rebias the exponent from float's 127 to half's 15, then drop 13 mantissa bits
+    uint32_t rebiased = mag - 0x38000000;
+    uint32_t result = rebiased >> 13;
+    uint32_t remainder = rebiased & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+        result++;
+
+    return sign | result;
+}
+
+// Takes a 16 bit value and its STORAGE_* format.
+// Returns it as a float.
+float half_to_float_one(uint16_t value, int format)
+{
+    uint32_t x;
+
+    if (format == STORAGE_BF16)
+    {
+        x = (uint32_t)value << 16;
+    }
+    else
+    {
+        uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1f;
+        uint32_t mantissa = value & 0x3ff;
+
+        if (exponent == 0x1f)
+        {
+            x = sign | 0x7f800000 | (mantissa << 13);
+        }
+        else if (exponent)
+        {
+            x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        else
+        {
+            // subnormal, mantissa steps of 2^-24, exact in a float
+            float f = mantissa * 5.9604644775390625e-8f;
+            memcpy(&x, &f, sizeof(x));
+            x |= sign;
+        }
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+#ifdef HALF_X86
+// 8 at a time, the scalar conversion finishing the rest.
+
+__attribute__((target("avx,f16c")))
+void half_from_float_f16c(uint16_t *out, const float *in, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(&in[i]), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i *)&out[i], h);
+    }
+    for (; i < n; i++)
+    {
+        out[i] = half_from_float_one(in[i], STORAGE_F16);
+    }
+}
+
+__attribute__((target("avx,f16c")))
+void half_to_float_f16c(float *out, const uint16_t *in, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(&out[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&in[i])));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = half_to_float_one(in[i], STORAGE_F16);
+    }
+}
+
+// bfloat16 is the top half of a float, so these are shifts, plus rounding on the way down.
+
+__attribute__((target("avx2")))
+void half_from_float_bf16_avx2(uint16_t *out, const float *in, int n)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i magMask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i inf = _mm256_set1_epi32(0x7f800000);
+    const __m256i quiet = _mm256_set1_epi32(0x40);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)&in[i]);
+        __m256i top = _mm256_srli_epi32(x, 16);
+        __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x, bias), _mm256_and_si256(top, one)), 16);
+        __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(x, magMask), inf);
+        __m256i r = _mm256_blendv_epi8(rounded, _mm256_or_si256(top, quiet), nan);
+
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+        _mm_storeu_si128((__m128i *)&out[i], packed);
+    }
+    for (; i < n; i++)
+    {
+        out[i] = half_from_float_one(in[i], STORAGE_BF16);
+    }
+}
+
+__attribute__((target("avx2")))
+void half_to_float_bf16_avx2(float *out, const uint16_t *in, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&in[i]));
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_slli_epi32(x, 16));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = half_to_float_one(in[i], STORAGE_BF16);
+    }
+}
+#endif
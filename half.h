@@ -0,0 +1,19 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+
+// How the grids are stored, compute is always in float.
+#define STORAGE_F32 0  // plain floats
+#define STORAGE_F16 1  // IEEE half floats, 11 significant bits, up to 65504
+#define STORAGE_BF16 2 // bfloat16, the top half of a float, 8 significant bits, float's range
+
+void half_init(void);
+const char *half_isa(int);
+
+void half_from_float(uint16_t *, const float *, int, int);
+void half_to_float(float *, const uint16_t *, int, int);
+uint16_t half_from_float_one(float, int);
+float half_to_float_one(uint16_t, int);
+
+#endif
@@ -8,22 +8,56 @@
 #include "bmp.h"        // defines and outputs BMP files from color arrays
 #include "loadingbar.h" // defines and draws progress bar in console, gives user something to stare at
 #include "heatmap.h"
+#include "options.h"    // optional --flags after the positional arguments
+#include "stencil.h"    // SIMD row kernels, picked once before threads start
+#include "activetiles.h" // skips settled parts of the matrix with --active-tiles
+#include "gridfile.h"   // binary, memory-mappable grid output
+#include "snapshot.h"   // writes --snapshot-every and --animate outputs on a background thread
+#include "tiles.h"      // zoomable --tiles pyramid for grids too big for one image
+#include "histogram.h"  // --auto-range percentiles of the final matrix
+#include "profile.h"    // --profile phase, timestep and per-thread timing
 
 #define EXPECTED_ARGS 9
 #define TRANSFER_MAX 1.1000001 // floating point imprecision, man
 #define TRASNFER_MIN 1
 
-void fill_heaters(float *, struct Heater *, int, int);
-void fill_heaters_parallel(float *, struct Heater *, int, int);
+// The matrices a run steps, swapped around instead of re-allocated. With --storage f16/bf16
+// the steps run on the 16 bit pair and the float matrix only holds copies for the outputs,
+// otherwise the 16 bit pair is NULL. Rows are stride cells apart, more than cols if padded.
+struct Grids
+{
+    float *matrix, *tmpMatrix;
+    uint16_t *halfMatrix, *halfTmp;
+    int cols, rows, stride;
+};
+
 void handle_loading_bar(int, int, struct LoadingBar *);
+int outputs_due(struct Options *, int, int);
+int checkpoint_due(struct Options *, double *, int, int);
+int seed_matrix(char *, float *, uint16_t *, int, int, int, int, struct GridFileHeader *);
+int grids_init(struct Grids *, struct Options *, int, int, float);
+int grids_seed(struct Grids *, struct Options *, char *, float, float, int, int *);
+int grids_widen(struct Grids *, struct Options *, float, int);
+float step_grids(struct Grids *, struct ActiveTiles *, float, float, int, int, int, struct HeaterSpans *,
+                 struct Options *, struct StepOutputs *);
+int simulate(struct Grids *, struct ActiveTiles *, float, float, int, int, int, struct HeaterSpans *,
+             struct Options *, struct SnapshotWriter *, struct LoadingBar *, struct Histogram *, struct Profile *);
+void write_grid_outputs(struct Grids *, struct Options *, float, float, int, int, char *, struct Profile *);
+void write_image_outputs(struct Grids *, struct Options *, float, float, unsigned char *, int, int, int, int,
+                         char *, struct Profile *);
+int simulate_persistent(float **, float **, int, int, int, int, float, float, int, int, int,
+                        struct HeaterSpans *, struct Options *, struct SnapshotWriter *, struct LoadingBar *,
+                        struct Profile *);
 
 
 int main(int argc, char **argv)
 {
-    if (argc != EXPECTED_ARGS)
+    struct Options opts = options_init();
+    if (argc < EXPECTED_ARGS || options_parse(&opts, argc - EXPECTED_ARGS, argv + EXPECTED_ARGS))
     {
         printf("Invalid usage.\n");
-        printf("Example: ./heat num_threads numRows numCols baseTemp k timesteps heaterFileName outputFileName\n");
+        printf("Example: ./heat num_threads numRows numCols baseTemp k timesteps heaterFileName outputFileName [options]\n");
+        options_usage();
         return 1;
     }
 
@@ -32,7 +66,6 @@ int main(int argc, char **argv)
     float baseTemp, transferRate;
     char *heaterFileName;
     char *outFileName;
-    char *outImgName;
 
     numThreads = atoi(argv[1]);
     numRows = atoi(argv[2]);
@@ -43,9 +76,6 @@ int main(int argc, char **argv)
     transferRate = strtod(argv[5], &ptr);
     heaterFileName = argv[7];
     outFileName = argv[8];
-    outImgName = (char *)malloc(sizeof(char) * strlen(outFileName) + 4);
-    strcpy(outImgName, outFileName);
-    strcat(outImgName, ".bmp");
 
 
     /* Argument validation and error prevention */
@@ -76,49 +106,41 @@ int main(int argc, char **argv)
 
     /* File reading, data and variable initialization */
 
+    // NULL without --profile, which every profile_phase call below then ignores
+    struct Profile *profile = opts.profile ? profile_init(numThreads) : NULL;
+    profile_phase(profile, PHASE_HEATERS);
+
     // heaters is a pointer array of heater structs to contain the row/col/temp of each heater
-    // dynamic arrays are impossible to calculate the length of in code, so that is stored from file
-    int heaterCount = get_heater_count(heaterFileName);
-    struct Heater *heaters = get_heaters(heaterFileName, heaterCount);
-    if (!heaters) // if get_heaters returns null, the file is bad or empty
+    // the file is text or binary, and every heater must land inside the matrix
+    int heaterCount, heaterError;
+    long heaterAt;
+    struct Heater *heaters = heater_load(heaterFileName, numRows, numCols, numThreads, &heaterCount, &heaterError,
+                                         &heaterAt);
+    if (!heaters)
     {
-        printf("ERROR: Heaters could not be found in file.\n");
+        heater_print_error(heaterFileName, heaterError, heaterAt);
         return 1;
     }
 
+    // sorted into spans along each row, which every step writes in place of computing them
+    struct HeaterSpans *spans = heater_spans_init(heaters, heaterCount, numRows, numThreads);
+
+    profile_phase(profile, PHASE_SETUP);
+
     // initialize loading bar for use in loop
     struct LoadingBar progress = loadingbar_init(50, '#', '-', '[', ']');
     loadingbar_draw(&progress);
 
     // initialize matrix of argument size and temp, fill it with heaters from file
-    // these matrices persist, and are swapped around instead of re-allocated
-    float *matrix = matrix_init(numCols, numRows, baseTemp);
-    float *tmpMatrix = matrix_init_empty(numCols, numRows);
-
-
-    /* Matrix timesteps, data processing into CSV and BMP image */
-
-    // timesteps equate to a "step" in time, the length of which is arbitrary.
-    // each time step runs the equation on each cell once, and then the heaters
-    // are replaced.
-    for (int i = 0; i < timesteps; i++)
+    struct Grids grids;
+    if (grids_init(&grids, &opts, numCols, numRows, baseTemp))
     {
-        fill_heaters(matrix, heaters, heaterCount, numCols);
-        matrix_step_parallel(&matrix, &tmpMatrix, numCols, numRows, transferRate, baseTemp, numThreads);
-
-        handle_loading_bar(i, timesteps - 1, &progress);
+        printf("ERROR: Matrix could not be allocated.\n");
+        return 1;
     }
-    fill_heaters(matrix, heaters, heaterCount, numCols);
-    printf("\n");
-
-    matrix_out(matrix, numCols, numRows, outFileName); // out to file
-
-    printf("\nHeat dispersion complete.\n");
-    printf("CSV format file saved to:\t%s\n", outFileName);
-    free(tmpMatrix);
-    free(heaters);
 
 
+    // image size is known up front, snapshots draw their images during the run
     // temp constants for testing
     const int imgDim = 1024;
     const int imgMaxMul = 5;
@@ -135,56 +157,645 @@ int main(int argc, char **argv)
         imgH *= ((float)numRows / (float)numCols);
     }
 
-    if (imgW > imgDim * imgMaxMul || imgH > imgDim * imgMaxMul)
+    unsigned char colors[] = {255, 224, 122, 
+                              96, 204, 143, 
+                              94, 84, 235};
+
+
+    /* Matrix timesteps, data processing into CSV and BMP image */
+
+    // timesteps equate to a "step" in time, the length of which is arbitrary.
+    // each time step runs the equation on each cell once, except heater cells,
+    // which are written with their temperature instead.
+    // with --fuse, several timesteps are done per call, each tile of the matrix
+    // being advanced all of them while it sits in cache.
+    // with --persistent, the whole loop runs inside one parallel region instead.
+    // with --epsilon, every --check-every steps the step also measures how much
+    // the matrix changed, and the run ends once that drops below epsilon.
+    // with --active-tiles, each step only touches tiles that are still changing.
+    // with --snapshot-every, a copy of the matrix is handed to a writer thread every
+    // N steps, the last step is left to the regular output below.
+    // with --animate, the same writer draws a small frame every N steps, plus the
+    // first and last state.
+    // with --checkpoint, the same writer also saves the matrix and step count every
+    // S seconds, which --resume starts back up from.
+    struct ActiveTiles *active = NULL;
+    if (opts.activeTiles)
+        active = activetiles_init(numCols, numRows, opts.activeThreshold);
+
+    struct SnapshotWriter *snapshots = NULL;
+    char *outGifName = (char *)malloc(strlen(outFileName) + 5);
+    strcpy(outGifName, outFileName);
+    strcat(outGifName, ".gif");
+    char *outCkptName = (char *)malloc(strlen(outFileName) + 6);
+    strcpy(outCkptName, outFileName);
+    strcat(outCkptName, ".ckpt");
+    if (opts.snapshotEvery || opts.animateEvery || opts.checkpointEvery > 0)
     {
-        printf("\nImage could not be generated. This is likely due to the matrix being extremely lopsided.\n");
-        printf("A very lopsided matrix will result in aspect ratio preservation being too extreme.\n");
+        int lopsided = imgW > imgDim * imgMaxMul || imgH > imgDim * imgMaxMul;
+        snapshots = snapshot_init(numCols, numRows, grids.stride, baseTemp, transferRate, opts.csvOut, opts.binaryOut,
+                                  opts.precision, lopsided ? 0 : imgW, imgH, opts.bmpOut, opts.pngOut, colors,
+                                  opts.pool, opts.range, outFileName, outCkptName);
+        if (!snapshots)
+        {
+            printf("ERROR: Snapshot writer could not be started.\n");
+            return 1;
+        }
+
+        if (opts.animateEvery && snapshot_animate(snapshots, outGifName, opts.frameSize))
+        {
+            printf("ERROR: Animation file %s could not be opened.\n", outGifName);
+            return 1;
+        }
+    }
 
-        free(outImgName);
-        free(matrix);
+    // --resume picks up where the checkpoint left off, --initial starts a new run
+    // from an earlier grid instead of from baseTemp
+    int startStep = 0;
+    if (grids_seed(&grids, &opts, outCkptName, baseTemp, transferRate, timesteps, &startStep))
+        return 1;
 
-        return 0;
+    // from here on every step leaves the heaters in place
+    if (grids.halfMatrix)
+        heater_spans_fill_half(spans, grids.halfMatrix, grids.stride, opts.storage);
+    else
+        heater_spans_fill(spans, grids.matrix, grids.stride);
+    if (opts.animateEvery)
+    {
+        if (grids.halfMatrix)
+            matrix_from_half(grids.matrix, grids.halfMatrix, numCols, numRows, grids.stride, opts.storage,
+                             numThreads);
+        snapshot_push(snapshots, grids.matrix, startStep, SNAPSHOT_FRAME);
     }
 
-    unsigned char colors[] = {255, 224, 122, 
-                              96, 204, 143, 
-                              94, 84, 235};
-    unsigned char *heatmap = generate_map_float(matrix, numCols, numRows, imgW, imgH, baseTemp, 25.0, colors);
+    struct Histogram *hist = NULL;
+    if (opts.autoRange)
+    {
+        hist = (struct Histogram *)malloc(sizeof(*hist));
+        histogram_init(hist, baseTemp);
+    }
 
-    // formats the above data to a real image
-    bmp_generate_image(heatmap, imgH, imgW, outImgName);
+    profile_phase(profile, PHASE_STEPS);
+    int stepsDone;
+    if (opts.persistent)
+        stepsDone = simulate_persistent(&grids.matrix, &grids.tmpMatrix, numCols, numRows, grids.stride,
+                                        opts.padded, transferRate, baseTemp, numThreads, startStep, timesteps,
+                                        spans, &opts, snapshots, &progress, profile);
+    else
+        stepsDone = simulate(&grids, active, transferRate, baseTemp, numThreads, startStep, timesteps, spans,
+                             &opts, snapshots, &progress, hist, profile);
+    profile_phase(profile, PHASE_FINISH);
+    heater_spans_free(spans);
+
+    // the outputs all take floats, widened now that the 16 bit matrices are done with
+    if (grids.halfMatrix && grids_widen(&grids, &opts, baseTemp, numThreads))
+    {
+        printf("ERROR: Matrix could not be allocated.\n");
+        return 1;
+    }
+
+    // a plain last step counts its values as it goes, every other way of stepping
+    // needs one more pass
+    if (hist && !hist->total)
+        histogram_fill(hist, grids.matrix, numCols, numRows, grids.stride, numThreads);
+    printf("\n");
+
+    float range = opts.range;
+    if (hist)
+    {
+        range = histogram_range(hist, opts.rangeLow, opts.rangeHigh);
+        free(hist);
+    }
+
+    if (snapshots)
+    {
+        if (opts.animateEvery)
+            snapshot_push(snapshots, grids.matrix, stepsDone, SNAPSHOT_FRAME);
+
+        int frames;
+        int written = snapshot_finish(snapshots, &frames);
+        if (written < 0)
+            printf("\nERROR: Animation could not be written to %s.\n", outGifName);
+        else if (opts.animateEvery)
+            printf("\nAnimation of %d frames saved to:\t%s\n", frames, outGifName);
+        if (opts.snapshotEvery && written >= 0)
+            printf("\n%d snapshots saved to:\t%s.step<N>\n", written, outFileName);
+    }
+    free(outGifName);
+
+    if (opts.resume)
+        printf("\nResumed from %s at timestep %d.\n", outCkptName, startStep);
+    else if (opts.initialFile)
+        printf("\nStarted from the matrix in %s.\n", opts.initialFile);
+    free(outCkptName);
+
+    if (stepsDone < timesteps)
+        printf("\nSteady state reached, converged at timestep %d of %d.\n", stepsDone, timesteps);
+
+    if (active)
+    {
+        printf("\nActive tiles skipped %.1f%% of tile updates.\n",
+               100.0 * active->skipped / (double)(active->computed + active->skipped));
+        activetiles_free(active);
+    }
+
+    write_grid_outputs(&grids, &opts, baseTemp, transferRate, stepsDone, numThreads, outFileName, profile);
+    if (opts.autoRange)
+        printf("Color range, p%g to p%g:\t%g +/- %.2f\n", opts.rangeLow, opts.rangeHigh, baseTemp, range);
+
+    int lopsided = imgW > imgDim * imgMaxMul || imgH > imgDim * imgMaxMul;
+    write_image_outputs(&grids, &opts, baseTemp, range, colors, imgW, imgH, lopsided, numThreads, outFileName,
+                        profile);
 
 
     /* Finalization and memory deallocation */
-    printf("BMP heatmap image saved to:\t%s\n", outImgName);
+    matrix_free(grids.tmpMatrix, numCols, grids.stride);
+    matrix_free(grids.matrix, numCols, grids.stride);
+    free(heaters);
+    profile_finish(profile, opts.profileFile);
 
-    free(outImgName);
-    free(matrix);
-    free(heatmap);
+    return 0;
+}
+
+// Takes the matrices to set up, options, dimensions and temperature.
+// Allocates the pair of matrices the steps swap between, padded with a ghost cell border
+// for --layout padded, 16 bit for --storage f16/bf16, in which case the float matrix is
+// only allocated up front if snapshots need it.
+// Returns 0 on success, 1 if any of them could not be allocated.
+int grids_init(struct Grids *grids, struct Options *opts, int cols, int rows, float baseTemp)
+{
+    int snapshots = opts->snapshotEvery || opts->animateEvery || opts->checkpointEvery > 0;
+    grids->matrix = grids->tmpMatrix = NULL;
+    grids->halfMatrix = grids->halfTmp = NULL;
+    grids->cols = cols;
+    grids->rows = rows;
+    grids->stride = cols;
+
+    if (opts->storage != STORAGE_F32)
+    {
+        grids->stride = matrix_padded_stride(cols);
+        grids->halfMatrix = matrix_init_half(cols, rows, baseTemp, opts->storage);
+        grids->halfTmp = matrix_init_half(cols, rows, baseTemp, opts->storage);
+        if (snapshots)
+            grids->matrix = matrix_init_padded(cols, rows, baseTemp);
+        return !grids->halfMatrix || !grids->halfTmp || (snapshots && !grids->matrix);
+    }
+
+    if (opts->padded)
+    {
+        grids->stride = matrix_padded_stride(cols);
+        grids->matrix = matrix_init_padded(cols, rows, baseTemp);
+        grids->tmpMatrix = matrix_init_padded(cols, rows, baseTemp);
+    }
+    else
+    {
+        grids->matrix = matrix_init(cols, rows, baseTemp);
+        grids->tmpMatrix = matrix_init_empty(cols, rows);
+    }
+    return !grids->matrix || !grids->tmpMatrix;
+}
+
+// Takes the matrices, options, the checkpoint file --resume reads, temperature, transfer
+// rate, timestep count, and where to put the timestep the run starts from.
+// Fills the matrix from the checkpoint with --resume or the grid file with --initial,
+// and leaves it at baseTemp with neither. Only --resume carries the step count over.
+// Returns 0 on success, 1 after printing why the file can't seed this run.
+int grids_seed(struct Grids *grids, struct Options *opts, char *ckptName, float baseTemp, float k, int timesteps,
+               int *startStep)
+{
+    *startStep = 0;
+    char *seedName = opts->resume ? ckptName : opts->initialFile;
+    if (!seedName)
+        return 0;
+
+    struct GridFileHeader seed;
+    int seedError = seed_matrix(seedName, grids->matrix, grids->halfMatrix, grids->cols, grids->rows, grids->stride,
+                                opts->storage, &seed);
+    if (seedError == 1)
+    {
+        printf("\nERROR: %s is missing, or not a grid file.\n", seedName);
+        return 1;
+    }
+    if (seedError == 2)
+    {
+        printf("\nERROR: %s holds a %u x %u matrix, not %d x %d.\n", seedName, seed.rows, seed.cols, grids->rows,
+               grids->cols);
+        return 1;
+    }
+
+    // only the step count is carried over, the rest must be the run that was interrupted
+    if (opts->resume && (seed.baseTemp != baseTemp || seed.k != k))
+    {
+        printf("\nERROR: %s was saved with baseTemp %g and k %g.\n", seedName, seed.baseTemp, seed.k);
+        return 1;
+    }
+    if (opts->resume && seed.timesteps > (uint32_t)timesteps)
+    {
+        printf("\nERROR: %s was saved at timestep %u, past the %d asked for.\n", seedName, seed.timesteps,
+               timesteps);
+        return 1;
+    }
+    if (opts->resume)
+        *startStep = (int)seed.timesteps;
+    return 0;
+}
+
+// Takes the matrices, options, temperature and thread count.
+// Widens the 16 bit matrix into the float one the outputs all take, allocating it if
+// snapshots didn't already, and frees the 16 bit pair.
+// Returns 0 on success, 1 if the float matrix could not be allocated.
+int grids_widen(struct Grids *grids, struct Options *opts, float baseTemp, int threads)
+{
+    matrix_free_half(grids->halfTmp, grids->stride);
+    grids->halfTmp = NULL;
+    if (!grids->matrix)
+        grids->matrix = matrix_init_padded(grids->cols, grids->rows, baseTemp);
+    if (!grids->matrix)
+        return 1;
 
+    matrix_from_half(grids->matrix, grids->halfMatrix, grids->cols, grids->rows, grids->stride, opts->storage,
+                     threads);
+    matrix_free_half(grids->halfMatrix, grids->stride);
+    grids->halfMatrix = NULL;
     return 0;
 }
 
+// Takes the matrices, the active tile tracker (NULL without --active-tiles), transfer rate,
+// temperature, thread count, how many timesteps to take, the CHANGE_* norm to measure,
+// heater spans, options, and the histogram and busy times to fill in (NULL for none).
+// Advances the matrices with the one kernel the options pick. Only the plain step fills
+// the histogram, and only the tiled kernel takes more than one timestep.
+// Returns how much the matrix changed by that norm, 0 for CHANGE_NONE and fused steps.
+float step_grids(struct Grids *grids, struct ActiveTiles *active, float k, float baseTemp, int threads, int steps,
+                 int norm, struct HeaterSpans *spans, struct Options *opts, struct StepOutputs *out)
+{
+    if (active)
+        return activetiles_step(active, &grids->matrix, &grids->tmpMatrix, grids->cols, grids->rows, grids->stride,
+                                k, baseTemp, opts->padded, threads, spans, norm, out);
+    if (grids->halfMatrix)
+        return matrix_step_half(&grids->halfMatrix, &grids->halfTmp, grids->cols, grids->rows, grids->stride, k,
+                                threads, norm, spans, opts->storage, out);
+    if (steps > 1)
+    {
+        matrix_step_tiled(&grids->matrix, &grids->tmpMatrix, grids->cols, grids->rows, grids->stride, k, baseTemp,
+                          threads, steps, spans, out);
+        return 0;
+    }
+    if (opts->padded)
+        return matrix_step_padded(&grids->matrix, &grids->tmpMatrix, grids->cols, grids->rows, grids->stride, k,
+                                  threads, norm, spans, out);
+    return matrix_step_parallel(&grids->matrix, &grids->tmpMatrix, grids->cols, grids->rows, k, baseTemp, threads,
+                                norm, spans, out);
+}
 
-// Takes a 2d array matrix, array of heaters, and the number of heaters.
-// Returns the matrix with the heaters placed where they belong, based on struct.
-void fill_heaters(float *matrix, struct Heater *heaters, int arrayLen, int cols)
+// Takes the matrices, the active tile tracker (NULL without --active-tiles), transfer rate,
+// temperature, thread count, the timestep to start from and the one to run to, heater
+// spans, options, the snapshot writer (NULL for none), the loading bar, the histogram the
+// last timestep counts into (NULL for none), and the profile (NULL for none).
+// Runs the timesteps one step_grids call at a time, --fuse of them per call, cut short
+// so every snapshot and frame lands on the end of a call.
+// Returns the number of timesteps run, fewer than asked for if --epsilon converged.
+int simulate(struct Grids *grids, struct ActiveTiles *active, float k, float baseTemp, int threads, int start,
+             int end, struct HeaterSpans *spans, struct Options *opts, struct SnapshotWriter *snapshots,
+             struct LoadingBar *progress, struct Histogram *hist, struct Profile *profile)
 {
-    for (int i = 0; i < arrayLen; i++)
+    double lastCheckpoint = omp_get_wtime();
+    int steps;
+    for (int i = start; i < end; i += steps)
     {
-        matrix[heaters[i].col + (heaters[i].row * cols)] = heaters[i].temp;
+        steps = opts->fuse;
+        if (steps > end - i)
+            steps = end - i;
+        // fused steps end on every snapshot and frame
+        if (opts->snapshotEvery && steps > opts->snapshotEvery - (i % opts->snapshotEvery))
+            steps = opts->snapshotEvery - (i % opts->snapshotEvery);
+        if (opts->animateEvery && steps > opts->animateEvery - (i % opts->animateEvery))
+            steps = opts->animateEvery - (i % opts->animateEvery);
+
+        // the first step has no previous matrix to compare against
+        int norm = CHANGE_NONE;
+        if (opts->epsilon > 0 && i > start && i % opts->checkEvery == 0)
+            norm = opts->norm;
+
+        // one untaken branch per timestep when not profiling, nothing per cell
+        double stepStart = profile ? omp_get_wtime() : 0;
+
+        struct StepOutputs out = {i + 1 == end ? hist : NULL, profile ? profile->busy : NULL};
+        float change = step_grids(grids, active, k, baseTemp, threads, steps, norm, spans, opts, &out);
+
+        if (profile)
+            profile_step(profile, omp_get_wtime() - stepStart, steps);
+
+        handle_loading_bar(i + steps - 1, end - 1, progress);
+
+        if (norm != CHANGE_NONE && change < opts->epsilon)
+            return i + 1;
+
+        int due = outputs_due(opts, i + steps, end) | checkpoint_due(opts, &lastCheckpoint, i + steps, end);
+        if (due)
+        {
+            if (grids->halfMatrix)
+                matrix_from_half(grids->matrix, grids->halfMatrix, grids->cols, grids->rows, grids->stride,
+                                 opts->storage, threads);
+            snapshot_push(snapshots, grids->matrix, i + steps, due);
+        }
     }
+    return end;
 }
 
-// not used, was easier and faster runtime to just not
-/*void fill_heaters_parallel(float *matrix, struct Heater *heaters, int arrayLen, int cols)
+// Takes the matrices, options, temperature, transfer rate, how many timesteps were run,
+// thread count, the output file name, and the profile (NULL for none).
+// Writes the CSV and binary grid files the options ask for, then reports the run done
+// and where they went.
+void write_grid_outputs(struct Grids *grids, struct Options *opts, float baseTemp, float k, int stepsDone,
+                        int threads, char *outFileName, struct Profile *profile)
 {
-    #pragma omp for schedule(static)
-    for (int i = 0; i < arrayLen; i++)
+    if (opts->csvOut)
     {
-        matrix[heaters[i].col + (heaters[i].row * cols)] = heaters[i].temp;
+        profile_phase(profile, PHASE_CSV);
+        matrix_out(grids->matrix, grids->cols, grids->rows, grids->stride, opts->precision, threads,
+                   outFileName); // out to file
     }
-}*/
+
+    char *outGridName = (char *)malloc(strlen(outFileName) + 6);
+    strcpy(outGridName, outFileName);
+    strcat(outGridName, ".grid");
+    int gridFailed = 0;
+    if (opts->binaryOut)
+    {
+        profile_phase(profile, PHASE_GRID);
+        gridFailed = gridfile_write(grids->matrix, grids->cols, grids->rows, grids->stride, baseTemp, k, stepsDone,
+                                    outGridName);
+    }
+
+    printf("\nHeat dispersion complete.\n");
+    if (opts->storage != STORAGE_F32)
+        printf("Grid cells stored as %s, converted with %s.\n", opts->storage == STORAGE_F16 ? "f16" : "bf16",
+               half_isa(opts->storage));
+    if (opts->csvOut)
+        printf("CSV format file saved to:\t%s\n", outFileName);
+    if (gridFailed)
+        printf("ERROR: Binary grid file could not be written to %s.\n", outGridName);
+    else if (opts->binaryOut)
+        printf("Binary grid file saved to:\t%s\n", outGridName);
+    free(outGridName);
+}
+
+// Takes the matrices, options, temperature, color range, the 3 colors, image dimensions,
+// whether those are too lopsided to draw, thread count, the output file name, and the
+// profile (NULL for none).
+// Writes the --tiles pyramid and the BMP and PNG heatmaps the options ask for, and
+// reports where they went.
+void write_image_outputs(struct Grids *grids, struct Options *opts, float baseTemp, float range,
+                         unsigned char *colors, int imgW, int imgH, int lopsided, int threads, char *outFileName,
+                         struct Profile *profile)
+{
+    // tiles come before the lopsided check, grids too big for one image are what they're for
+    if (opts->tiles)
+    {
+        profile_phase(profile, PHASE_TILES);
+        char *outTilesName = (char *)malloc(strlen(outFileName) + 7);
+        strcpy(outTilesName, outFileName);
+        strcat(outTilesName, ".tiles");
+        int levels, tileCount;
+        if (tiles_write(grids->matrix, grids->cols, grids->rows, grids->stride, baseTemp, range, colors, opts->pool,
+                        threads, outTilesName, &levels, &tileCount))
+            printf("ERROR: Heatmap tiles could not be written to %s.\n", outTilesName);
+        else
+            printf("Heatmap tiles saved to:\t\t%s (%d levels, %d tiles)\n", outTilesName, levels, tileCount);
+        free(outTilesName);
+    }
+
+    if (lopsided)
+    {
+        printf("\nImage could not be generated. This is likely due to the matrix being extremely lopsided.\n");
+        printf("A very lopsided matrix will result in aspect ratio preservation being too extreme.\n");
+        return;
+    }
+
+    // draws the heatmap straight into the image file's pixel array
+    char *outImgName = (char *)malloc(strlen(outFileName) + 5);
+    strcpy(outImgName, outFileName);
+    strcat(outImgName, ".bmp");
+    int imgFailed = 0;
+    if (opts->bmpOut)
+    {
+        profile_phase(profile, PHASE_BMP);
+        imgFailed = generate_bmp_float(grids->matrix, grids->cols, grids->rows, grids->stride, imgW, imgH, baseTemp,
+                                       range, colors, opts->pool, threads, outImgName);
+    }
+
+    char *outPngName = (char *)malloc(strlen(outFileName) + 5);
+    strcpy(outPngName, outFileName);
+    strcat(outPngName, ".png");
+    size_t pngSize = 0;
+    int pngFailed = 0;
+    if (opts->pngOut)
+    {
+        profile_phase(profile, PHASE_PNG);
+        pngFailed = generate_png_float(grids->matrix, grids->cols, grids->rows, grids->stride, imgW, imgH, baseTemp,
+                                       range, colors, opts->pool, threads, outPngName, &pngSize);
+    }
+
+    if (imgFailed)
+        printf("ERROR: BMP heatmap image could not be written to %s.\n", outImgName);
+    else if (opts->bmpOut)
+        printf("BMP heatmap image saved to:\t%s (%.1f MB)\n", outImgName,
+               (BMP_HEADER_SIZE + ((double)bmp_row_bytes(imgW) * imgH)) / (1024 * 1024));
+    if (pngFailed)
+        printf("ERROR: PNG heatmap image could not be written to %s.\n", outPngName);
+    else if (opts->pngOut)
+        printf("PNG heatmap image saved to:\t%s (%.1f MB)\n", outPngName, pngSize / (1024.0 * 1024));
+
+    free(outImgName);
+    free(outPngName);
+}
+
+// Takes ADDRESS of both matrices, dimensions, stride, whether they are padded,
+// transfer rate, temperature, thread count, the timestep to start from and the one to
+// run to, heater spans, options, the snapshot writer (NULL for none), the loading bar, and
+// the profile (NULL for none), which thread 0 gives each step's time and every thread its busy time.
+// Runs every timestep inside a single parallel region, so threads are started once
+// instead of once per step. Each thread owns a fixed band of rows, heaters included,
+// so the only synchronization left is one barrier per step. Matrix must already have
+// its heaters filled in.
+// Snapshots and checkpoints are copied by thread 0 while the others start the next step,
+// which only reads the matrix being copied, so they cost no extra barrier.
+// Returns the number of timesteps run, fewer than asked for if --epsilon converged.
+int simulate_persistent(float **matrix, float **tmpMatrix, int cols, int rows, int stride, int padded,
+                        float k, float base, int numThreads, int startStep, int timesteps,
+                        struct HeaterSpans *spans, struct Options *opts,
+                        struct SnapshotWriter *snapshots, struct LoadingBar *bar, struct Profile *profile)
+{
+    int stepsDone = timesteps;
+
+    // per thread change for convergence checks, two sets used alternately so a fast
+    // thread writing the next check can't clobber one a slow thread is still reading
+    float *partMax = (float *)malloc(2 * numThreads * sizeof(float));
+    double *partSq = (double *)malloc(2 * numThreads * sizeof(double));
+
+    stencil_init();
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        // private copies, every thread swaps its own in lockstep with the others
+        float *cur = *matrix;
+        float *next = *tmpMatrix;
+
+        int thread = omp_get_thread_num();
+        int team = omp_get_num_threads();
+        int rowStart = (int)(((long)rows * thread) / team);
+        int rowEnd = (int)(((long)rows * (thread + 1)) / team);
+        int parity = 0;
+        double lastCheckpoint = omp_get_wtime(); // thread 0's, the only one that checks
+        double stepStart = lastCheckpoint;       // thread 0's, for the profile
+
+        for (int i = startStep; i < timesteps; i++)
+        {
+            int check = opts->epsilon > 0 && i > startStep && i % opts->checkEvery == 0;
+            float maxChange = 0;
+            double sqChange = 0;
+
+            double busyStart = profile ? omp_get_wtime() : 0;
+            matrix_step_rows(cur, next, cols, rows, stride, k, base, padded, rowStart, rowEnd, spans,
+                             check ? &maxChange : NULL, check ? &sqChange : NULL);
+            if (profile)
+                profile->busy[thread] += omp_get_wtime() - busyStart;
+
+            if (check)
+            {
+                partMax[thread + (parity * numThreads)] = maxChange;
+                partSq[thread + (parity * numThreads)] = sqChange;
+            }
+
+            // nobody reads next as their current matrix until every band is done
+            #pragma omp barrier
+
+            float *tmp = cur;
+            cur = next;
+            next = tmp;
+
+            if (thread == 0)
+            {
+                if (profile)
+                {
+                    double now = omp_get_wtime();
+                    profile_step(profile, now - stepStart, 1);
+                    stepStart = now;
+                }
+                handle_loading_bar(i, timesteps - 1, bar);
+            }
+
+            if (check)
+            {
+                // every thread sums the same numbers, so they all leave on the same step
+                maxChange = 0;
+                sqChange = 0;
+                for (int t = 0; t < team; t++)
+                {
+                    float m = partMax[t + (parity * numThreads)];
+                    maxChange = m > maxChange ? m : maxChange;
+                    sqChange += partSq[t + (parity * numThreads)];
+                }
+                parity = !parity;
+
+                if (matrix_change(opts->norm, maxChange, sqChange) < opts->epsilon)
+                {
+                    if (thread == 0)
+                        stepsDone = i + 1;
+                    break;
+                }
+            }
+
+            if (thread == 0)
+            {
+                int due = outputs_due(opts, i + 1, timesteps) | checkpoint_due(opts, &lastCheckpoint, i + 1,
+                                                                               timesteps);
+                if (due)
+                    snapshot_push(snapshots, cur, i + 1, due);
+            }
+        }
+    }
+
+    free(partMax);
+    free(partSq);
+
+    // an odd number of steps leaves the newest matrix in the temporary's place
+    if ((stepsDone - startStep) % 2)
+    {
+        float *tmp = *matrix;
+        *matrix = *tmpMatrix;
+        *tmpMatrix = tmp;
+    }
+
+    return stepsDone;
+}
+
+// Takes the options, how many timesteps are done, and how many the run has.
+// Returns the SNAPSHOT_* outputs due at that point, 0 for none. The last timestep
+// is left to the regular output and the animation's closing frame.
+int outputs_due(struct Options *opts, int done, int timesteps)
+{
+    if (done >= timesteps)
+        return 0;
+
+    int due = 0;
+    if (opts->snapshotEvery && done % opts->snapshotEvery == 0)
+        due |= SNAPSHOT_FILES;
+    if (opts->animateEvery && done % opts->animateEvery == 0)
+        due |= SNAPSHOT_FRAME;
+
+    return due;
+}
+
+// Takes the options, when the last checkpoint was taken (omp_get_wtime, updated if
+// one is due now), how many timesteps are done, and how many the run has.
+// Returns SNAPSHOT_CHECKPOINT once --checkpoint seconds have passed, 0 otherwise.
+// The last timestep is left to the regular output, which makes a checkpoint pointless.
+int checkpoint_due(struct Options *opts, double *lastCheckpoint, int done, int timesteps)
+{
+    if (opts->checkpointEvery <= 0 || done >= timesteps)
+        return 0;
+
+    double now = omp_get_wtime();
+    if (now - *lastCheckpoint < opts->checkpointEvery)
+        return 0;
+
+    *lastCheckpoint = now;
+    return SNAPSHOT_CHECKPOINT;
+}
+
+// Takes a grid file name, the matrix to fill, float or 16 bit (the other one NULL),
+// dimensions, row stride, the STORAGE_* format, and where to put the file's header.
+// Copies the file's cells into the matrix, for --resume and --initial.
+// Returns 0 on success, 1 if it is missing or not a grid file, 2 if its dimensions differ.
+int seed_matrix(char *fileName, float *matrix, uint16_t *halfMatrix, int cols, int rows, int stride, int storage,
+                struct GridFileHeader *info)
+{
+    struct GridFileHeader *header;
+    size_t mapSize;
+    float *cells = gridfile_map(fileName, &header, &mapSize);
+    if (!cells)
+        return 1;
+
+    *info = *header;
+    if (header->rows != (uint32_t)rows || header->cols != (uint32_t)cols)
+    {
+        gridfile_unmap(header, mapSize);
+        return 2;
+    }
+
+    for (int i = 0; i < rows; i++)
+    {
+        if (halfMatrix)
+            half_from_float(&halfMatrix[(size_t)i * stride], &cells[(size_t)i * cols], cols, storage);
+        else
+            memcpy(&matrix[(size_t)i * stride], &cells[(size_t)i * cols], cols * sizeof(float));
+    }
+
+    gridfile_unmap(header, mapSize);
+    return 0;
+}
 
 // Handles loading bar, checks if it needs an update.
 // Conditions for update are an increase in whole-number percent,
@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <omp.h>
+#include "heatmap.h"
+#include "matrix.h"
+#include "stencil.h"
+#include "activetiles.h"
+#include "bmp.h"
+
+// Benchmarks pieces of the program on their own, away from the simulation.
+// Every step kernel runs on grids sized to sit in L1, L2, the last level cache and
+// DRAM, at 1, 2, 4 ... threads, with no, sparse and dense heaters. The render, CSV
+// and BMP stages are timed on their own. Results are written as JSON, progress to stderr.
+// Build: make heat_bench
+// Usage: heat_bench [trials] [maxThreads] [jsonFile]
+
+#define BENCH_TRIALS_DEFAULT 5
+#define BENCH_WARMUP 1                 // untimed trials before the timed ones
+#define BENCH_TRIAL_CELLS 100000000.0  // cell updates per trial, small grids run more steps
+#define BENCH_MAX_STEPS 4096           // steps per trial at most, a multiple of BENCH_FUSE
+#define BENCH_FUSE 4                   // timesteps per call for the tiled kernel
+#define BENCH_STAGE_SIZE 4096          // grid the output stages are timed on
+#define BENCH_BASE 20.0
+#define BENCH_K 1.0 // anything above 1 grows the grid every step until it overflows
+#define BENCH_HEATER_TEMP 100.0
+
+// kernels heat can step with, persistent mode lives in heat.c and runs the padded one
+#define KERNEL_PARALLEL 0 // matrix_step_parallel, the default
+#define KERNEL_PADDED 1   // matrix_step_padded, --layout padded
+#define KERNEL_TILED 2    // matrix_step_tiled, --fuse BENCH_FUSE
+#define KERNEL_BF16 3     // matrix_step_half, --storage bf16
+#define KERNEL_ACTIVE 4   // activetiles_step, --active-tiles 0
+#define KERNEL_COUNT 5
+
+#define DENSITY_COUNT 3
+
+struct BenchSize
+{
+    const char *name;
+    int size; // cells per side
+};
+
+struct BenchJson
+{
+    FILE *out;
+    int first; // no comma before the next object
+};
+
+int bench_side_for(long, int);
+long bench_cache_size(int, long);
+struct Heater *bench_heaters(int, int, int);
+double bench_median(double *, int);
+double bench_step(int, int, int, int, int, int, int, double *, int *, double *);
+void bench_stage_render(struct BenchJson *, float *, int, int, int, int, int, int, int, unsigned char *);
+void bench_stage_csv(struct BenchJson *, float *, int, int, int);
+void bench_stage_bmp(struct BenchJson *, float *, int, int, unsigned char *);
+void bench_json_open(struct BenchJson *);
+float bench_cell(int, int, int, int, float);
+void bench_fill(float *, int, int, int, float);
+void bench_seed(float *, uint16_t *, int, int, int, struct HeaterSpans *);
+
+const char *kernelNames[] = {"parallel", "padded", "tiled", "bf16", "active"};
+const char *densityNames[] = {"none", "sparse", "dense"};
+const double densities[] = {0, 0.0001, 0.01}; // heaters per cell
+
+int main(int argc, char **argv)
+{
+    int trials = argc > 1 ? atoi(argv[1]) : BENCH_TRIALS_DEFAULT;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : omp_get_max_threads();
+    if (trials < 1 || maxThreads < 1)
+    {
+        printf("Invalid arguments, correct usage: heat_bench [trials] [maxThreads] [jsonFile]\n");
+        return 1;
+    }
+
+    struct BenchJson json = {stdout, 1};
+    if (argc > 3 && !(json.out = fopen(argv[3], "w")))
+    {
+        printf("ERROR: %s could not be opened.\n", argv[3]);
+        return 1;
+    }
+
+    // each grid is sized so the two matrices a step touches fill half the cache,
+    // the DRAM one so they are 4 times the last level cache
+    long l1 = bench_cache_size(_SC_LEVEL1_DCACHE_SIZE, 32L << 10);
+    long l2 = bench_cache_size(_SC_LEVEL2_CACHE_SIZE, 1L << 20);
+    long llc = bench_cache_size(_SC_LEVEL3_CACHE_SIZE, 32L << 20);
+    struct BenchSize sizes[] = {{"L1", bench_side_for(l1 / 2, 16)},
+                                {"L2", bench_side_for(l2 / 2, 16)},
+                                {"LLC", bench_side_for(llc / 2, 16)},
+                                {"DRAM", bench_side_for(llc * 4, 4096)}};
+    int sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+
+    int threadCounts[32];
+    int threadCount = 0;
+    for (int t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts[threadCount++] = t;
+    }
+    threadCounts[threadCount++] = maxThreads;
+
+    fprintf(json.out, "{\n  \"host\": {\"threads\": %d, \"l1\": %ld, \"l2\": %ld, \"llc\": %ld, \"kernel\": \"%s\"},\n",
+            omp_get_max_threads(), l1, l2, llc, stencil_isa());
+    fprintf(json.out, "  \"trials\": %d,\n  \"warmup\": %d,\n  \"steps\": [", trials, BENCH_WARMUP);
+
+    double *times = (double *)malloc(trials * sizeof(double));
+    for (int kernel = 0; kernel < KERNEL_COUNT; kernel++)
+    {
+        for (int s = 0; s < sizeCount; s++)
+        {
+            for (int d = 0; d < DENSITY_COUNT; d++)
+            {
+                int side = sizes[s].size;
+                int heaterCount = (int)ceil(densities[d] * side * side);
+                double cells = (double)side * side;
+                double serial = 0; // cells per second on 1 thread, for efficiency
+
+                for (int t = 0; t < threadCount; t++)
+                {
+                    int steps;
+                    double computed; // share of the grid the kernel actually updated
+                    double perStep = bench_step(kernel, side, side, heaterCount, threadCounts[t], trials,
+                                                BENCH_WARMUP, times, &steps, &computed);
+                    if (perStep == -1)
+                    {
+                        fprintf(stderr, "ERROR: %dx%d grid could not be allocated.\n", side, side);
+                        return 1;
+                    }
+                    if (perStep == -2)
+                    {
+                        fprintf(stderr, "ERROR: %s kernel left non-finite cells in the %dx%d grid.\n",
+                                kernelNames[kernel], side, side);
+                        return 1;
+                    }
+                    if (computed <= 0)
+                    {
+                        fprintf(stderr, "ERROR: %s kernel skipped every cell of the %dx%d grid.\n",
+                                kernelNames[kernel], side, side);
+                        return 1;
+                    }
+
+                    double cellsPerSec = cells / perStep;
+                    if (threadCounts[t] == 1)
+                        serial = cellsPerSec;
+
+                    // effective traffic assumes every cell is read once and written once per step,
+                    // so kernels that reuse cache (tiled) or skip cells (active) can beat DRAM,
+                    // computed says how much of the grid the active kernel really stepped
+                    double bytesPerCell = 2 * (kernel == KERNEL_BF16 ? sizeof(uint16_t) : sizeof(float));
+
+                    bench_json_open(&json);
+                    fprintf(json.out, "{\"kernel\": \"%s\", \"size\": \"%s\", \"rows\": %d, \"cols\": %d, "
+                            "\"heaters\": \"%s\", \"heater_count\": %d, \"threads\": %d, \"steps\": %d, "
+                            "\"median_s\": %.9g, \"min_s\": %.9g, \"cells_per_s\": %.6g, \"gb_per_s\": %.4g, "
+                            "\"efficiency\": %.3f, \"computed\": %.4f}", kernelNames[kernel], sizes[s].name, side, side,
+                            densityNames[d], heaterCount, threadCounts[t], steps, perStep, times[0] / steps, cellsPerSec,
+                            cellsPerSec * bytesPerCell / 1e9, serial > 0 ? cellsPerSec / (serial * threadCounts[t]) : 0,
+                            computed);
+                    fflush(json.out);
+
+                    fprintf(stderr, "%-8s %-4s %5dx%-5d %-6s heaters, %2d threads: %8.1f Mcells/s, %6.2f GB/s, "
+                            "%5.1f%% computed\n", kernelNames[kernel], sizes[s].name, side, side, densityNames[d],
+                            threadCounts[t], cellsPerSec / 1e6, cellsPerSec * bytesPerCell / 1e9, computed * 100);
+                }
+            }
+        }
+    }
+    free(times);
+
+    float *grid = (float *)malloc((size_t)BENCH_STAGE_SIZE * BENCH_STAGE_SIZE * sizeof(float));
+    if (!grid)
+    {
+        fprintf(stderr, "ERROR: %dx%d grid could not be allocated.\n", BENCH_STAGE_SIZE, BENCH_STAGE_SIZE);
+        return 1;
+    }
+    bench_fill(grid, BENCH_STAGE_SIZE, BENCH_STAGE_SIZE, BENCH_STAGE_SIZE, BENCH_BASE);
+
+    unsigned char colors[] = {255, 224, 122,
+                              96, 204, 143,
+                              94, 84, 235};
+
+    fprintf(json.out, "\n  ],\n  \"stages\": [");
+    json.first = 1;
+    for (int t = 0; t < threadCount; t++)
+    {
+        int threads = threadCounts[t];
+        int size = BENCH_STAGE_SIZE;
+        bench_stage_render(&json, grid, size, size, 1024, 1024, POOL_MEAN, trials, threads, colors); // cells per pixel, the usual case
+        bench_stage_render(&json, grid, size, size, 1024, 1024, POOL_MAX, trials, threads, colors);
+        bench_stage_render(&json, grid, size, size, 256, 256, POOL_MEAN, trials, threads, colors);   // animation frame sized
+        bench_stage_render(&json, grid, size, size, 5120, 5120, POOL_MEAN, trials, threads, colors); // pixels per cell, biggest image heat draws
+        bench_stage_csv(&json, grid, size, trials, threads);
+    }
+    bench_stage_bmp(&json, grid, BENCH_STAGE_SIZE, trials, colors);
+    fprintf(json.out, "\n  ]\n}\n");
+
+    if (json.out != stdout)
+        fclose(json.out);
+    free(grid);
+    return 0;
+}
+
+// Takes a number of bytes and the smallest side to return.
+// Returns the side of the square float grid pair that fits in those bytes.
+int bench_side_for(long bytes, int minSide)
+{
+    int side = (int)sqrt((double)bytes / (2 * sizeof(float)));
+    return side < minSide ? minSide : side;
+}
+
+// Takes a sysconf cache name and the size to assume when the system doesn't say.
+// Returns the cache's size in bytes.
+long bench_cache_size(int name, long fallback)
+{
+    long size = sysconf(name);
+    return size > 0 ? size : fallback;
+}
+
+// Takes dimensions and a heater count.
+// Returns heaters scattered over the grid, the same ones every run.
+struct Heater *bench_heaters(int cols, int rows, int count)
+{
+    struct Heater *heaters = (struct Heater *)malloc((count + 1) * sizeof(struct Heater));
+    unsigned int seed = 12345;
+    for (int n = 0; n < count; n++)
+    {
+        seed = (seed * 1103515245) + 12345;
+        heaters[n].row = (seed >> 8) % rows;
+        seed = (seed * 1103515245) + 12345;
+        heaters[n].col = (seed >> 8) % cols;
+        heaters[n].temp = BENCH_HEATER_TEMP;
+    }
+    return heaters;
+}
+
+// Takes trial times and how many there are.
+// Sorts them, returns the middle one.
+double bench_median(double *times, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        double t = times[i];
+        int j = i - 1;
+        for (; j >= 0 && times[j] > t; j--)
+        {
+            times[j + 1] = times[j];
+        }
+        times[j + 1] = t;
+    }
+    return count % 2 ? times[count / 2] : (times[(count / 2) - 1] + times[count / 2]) / 2;
+}
+
+// Takes a KERNEL_* kernel, dimensions, heater count, thread count, trials, warmup trials, where
+// to put each trial's time (sorted), the steps per trial, and the share of cells actually stepped.
+// Every trial starts over from the same bench_fill field with the heaters in place, so no trial
+// runs on a grid an earlier one already smoothed out, and the active kernel always has work.
+// Returns the median seconds per timestep, -1 if the grid could not be allocated,
+// or -2 if a trial left a cell that isn't finite.
+double bench_step(int kernel, int cols, int rows, int heaterCount, int numThreads, int trials, int warmup,
+                  double *times, int *stepsOut, double *computedOut)
+{
+    int padded = kernel == KERNEL_PADDED || kernel == KERNEL_BF16;
+    int stride = padded ? matrix_padded_stride(cols) : cols;
+    float *matrix = NULL, *tmpMatrix = NULL;
+    uint16_t *half = NULL, *halfTmp = NULL;
+    if (kernel == KERNEL_BF16)
+    {
+        half = matrix_init_half(cols, rows, BENCH_BASE, STORAGE_BF16);
+        halfTmp = matrix_init_half(cols, rows, BENCH_BASE, STORAGE_BF16);
+        if (!half || !halfTmp)
+            return -1;
+    }
+    else
+    {
+        matrix = padded ? matrix_init_padded(cols, rows, BENCH_BASE) : matrix_init(cols, rows, BENCH_BASE);
+        tmpMatrix = padded ? matrix_init_padded(cols, rows, BENCH_BASE) : matrix_init(cols, rows, BENCH_BASE);
+        if (!matrix || !tmpMatrix)
+            return -1;
+    }
+
+    struct Heater *heaters = bench_heaters(cols, rows, heaterCount);
+    struct HeaterSpans *spans = heater_spans_init(heaters, heaterCount, rows, numThreads);
+    free(heaters);
+
+    // small grids would otherwise run tens of thousands of steps per trial
+    int steps = (int)ceil(BENCH_TRIAL_CELLS / ((double)cols * rows));
+    if (steps > BENCH_MAX_STEPS)
+        steps = BENCH_MAX_STEPS;
+    if (kernel == KERNEL_TILED)
+        steps = ((steps + BENCH_FUSE - 1) / BENCH_FUSE) * BENCH_FUSE;
+
+    struct ActiveTiles *active = NULL;
+    long long computed = 0, skipped = 0;
+    int finite = 1;
+    for (int trial = -warmup; trial < trials; trial++)
+    {
+        bench_seed(matrix, half, cols, rows, stride, spans);
+        bench_seed(tmpMatrix, halfTmp, cols, rows, stride, spans);
+        if (kernel == KERNEL_ACTIVE)
+        {
+            // a fresh tracker knows nothing, so its first step runs every tile like heat's does
+            if (active)
+                activetiles_free(active);
+            active = activetiles_init(cols, rows, 0);
+        }
+
+        double start = omp_get_wtime();
+        for (int i = 0; i < steps; i += kernel == KERNEL_TILED ? BENCH_FUSE : 1)
+        {
+            if (kernel == KERNEL_PARALLEL)
+                matrix_step_parallel(&matrix, &tmpMatrix, cols, rows, BENCH_K, BENCH_BASE, numThreads, CHANGE_NONE,
+                                     spans, NULL);
+            else if (kernel == KERNEL_PADDED)
+                matrix_step_padded(&matrix, &tmpMatrix, cols, rows, stride, BENCH_K, numThreads, CHANGE_NONE, spans,
+                                   NULL);
+            else if (kernel == KERNEL_TILED)
+                matrix_step_tiled(&matrix, &tmpMatrix, cols, rows, stride, BENCH_K, BENCH_BASE, numThreads,
+                                  BENCH_FUSE, spans, NULL);
+            else if (kernel == KERNEL_BF16)
+                matrix_step_half(&half, &halfTmp, cols, rows, stride, BENCH_K, numThreads, CHANGE_NONE, spans,
+                                 STORAGE_BF16, NULL);
+            else
+                activetiles_step(active, &matrix, &tmpMatrix, cols, rows, stride, BENCH_K, BENCH_BASE, 0,
+                                 numThreads, spans, CHANGE_NONE, NULL);
+        }
+        if (trial >= 0)
+            times[trial] = omp_get_wtime() - start;
+
+        if (active && trial >= 0)
+        {
+            computed += active->computed;
+            skipped += active->skipped;
+        }
+
+        // a grid that blew up would make every kernel look fast for the wrong reasons
+        for (int i = 0; i < rows && finite; i++)
+        {
+            for (int j = 0; j < cols && finite; j++)
+            {
+                size_t cell = j + ((size_t)i * stride);
+                finite = isfinite(half ? half_to_float_one(half[cell], STORAGE_BF16) : matrix[cell]);
+            }
+        }
+    }
+
+    if (active)
+        activetiles_free(active);
+    heater_spans_free(spans);
+    if (half)
+    {
+        matrix_free_half(half, stride);
+        matrix_free_half(halfTmp, stride);
+    }
+    else if (padded)
+    {
+        matrix_free(matrix, cols, stride);
+        matrix_free(tmpMatrix, cols, stride);
+    }
+    else
+    {
+        free(matrix);
+        free(tmpMatrix);
+    }
+
+    *stepsOut = steps;
+    *computedOut = computed + skipped ? (double)computed / (computed + skipped) : 1;
+    if (!finite)
+        return -2;
+    return bench_median(times, trials) / steps;
+}
+
+// Takes the JSON output, a grid, dimensions, image size, POOL_* mode, trials, thread count, and colors.
+// Times generate_map_float and writes the median run.
+void bench_stage_render(struct BenchJson *json, float *grid, int cols, int rows, int imgW, int imgH, int pool,
+                        int trials, int numThreads, unsigned char *colors)
+{
+    double *times = (double *)malloc(trials * sizeof(double));
+
+    for (int r = -BENCH_WARMUP; r < trials; r++)
+    {
+        double start = omp_get_wtime();
+        unsigned char *heatmap = generate_map_float(grid, cols, rows, cols, imgW, imgH, BENCH_BASE, 25.0, colors, pool,
+                                                    numThreads);
+        double elapsed = omp_get_wtime() - start;
+
+        free(heatmap);
+        if (r >= 0)
+            times[r] = elapsed;
+    }
+
+    const char *poolNames[] = {"mean", "max", "min"};
+    double median = bench_median(times, trials);
+    bench_json_open(json);
+    fprintf(json->out, "{\"stage\": \"render\", \"rows\": %d, \"cols\": %d, \"img_w\": %d, \"img_h\": %d, "
+            "\"pool\": \"%s\", \"threads\": %d, \"median_s\": %.9g, \"cells_per_s\": %.6g, \"pixels_per_s\": %.6g}",
+            rows, cols, imgW, imgH, poolNames[pool], numThreads, median, ((double)cols * rows) / median,
+            ((double)imgW * imgH) / median);
+    fprintf(stderr, "render   %5dx%-5d image, %-4s, %2d threads: %8.4f s, %7.1f Mcells/s, %7.1f Mpixels/s\n", imgW,
+            imgH, poolNames[pool], numThreads, median, ((double)cols * rows) / median / 1e6,
+            ((double)imgW * imgH) / median / 1e6);
+    free(times);
+}
+
+// Takes the JSON output, a square grid and its side, trials, and thread count.
+// Times matrix_out writing it to a scratch file in the current directory, then removes it.
+void bench_stage_csv(struct BenchJson *json, float *grid, int size, int trials, int numThreads)
+{
+    char *fileName = "heat_bench.tmp.csv";
+    double *times = (double *)malloc(trials * sizeof(double));
+
+    for (int r = -BENCH_WARMUP; r < trials; r++)
+    {
+        double start = omp_get_wtime();
+        matrix_out(grid, size, size, size, 1, numThreads, fileName);
+        if (r >= 0)
+            times[r] = omp_get_wtime() - start;
+    }
+
+    struct stat info;
+    double bytes = stat(fileName, &info) ? 0 : info.st_size;
+    unlink(fileName);
+
+    double median = bench_median(times, trials);
+    bench_json_open(json);
+    fprintf(json->out, "{\"stage\": \"csv\", \"rows\": %d, \"cols\": %d, \"threads\": %d, \"median_s\": %.9g, "
+            "\"cells_per_s\": %.6g, \"mb_per_s\": %.6g}", size, size, numThreads, median,
+            ((double)size * size) / median, bytes / median / 1e6);
+    fprintf(stderr, "csv      %5dx%-5d grid,        %2d threads: %8.4f s, %7.1f Mcells/s, %7.1f MB/s\n", size, size,
+            numThreads, median, ((double)size * size) / median / 1e6, bytes / median / 1e6);
+    free(times);
+}
+
+// Takes the JSON output, a square grid and its side, trials, and colors.
+// Renders the grid at heat's default and largest image sizes, then times
+// bmp_generate_image writing each to a scratch file, which is removed after.
+void bench_stage_bmp(struct BenchJson *json, float *grid, int size, int trials, unsigned char *colors)
+{
+    char *fileName = "heat_bench.tmp.bmp";
+    int dims[] = {1024, 5120};
+    double *times = (double *)malloc(trials * sizeof(double));
+
+    for (int d = 0; d < 2; d++)
+    {
+        int dim = dims[d];
+        unsigned char *heatmap = generate_map_float(grid, size, size, size, dim, dim, BENCH_BASE, 25.0, colors,
+                                                    POOL_MEAN, omp_get_max_threads());
+        for (int r = -BENCH_WARMUP; r < trials; r++)
+        {
+            double start = omp_get_wtime();
+            bmp_generate_image(heatmap, dim, dim, fileName);
+            if (r >= 0)
+                times[r] = omp_get_wtime() - start;
+        }
+        free(heatmap);
+        unlink(fileName);
+
+        double median = bench_median(times, trials);
+        double bytes = BMP_HEADER_SIZE + ((double)bmp_row_bytes(dim) * dim);
+        bench_json_open(json);
+        fprintf(json->out, "{\"stage\": \"bmp\", \"img_w\": %d, \"img_h\": %d, \"threads\": 1, \"median_s\": %.9g, "
+                "\"pixels_per_s\": %.6g, \"mb_per_s\": %.6g}", dim, dim, median, ((double)dim * dim) / median,
+                bytes / median / 1e6);
+        fprintf(stderr, "bmp      %5dx%-5d image,        1 thread:  %8.4f s, %7.1f Mpixels/s, %7.1f MB/s\n", dim,
+                dim, median, ((double)dim * dim) / median / 1e6, bytes / median / 1e6);
+    }
+    free(times);
+}
+
+// Takes the JSON output, starts the next object of the current list on its own line.
+void bench_json_open(struct BenchJson *json)
+{
+    fprintf(json->out, "%s\n    ", json->first ? "" : ",");
+    json->first = 0;
+}
+
+// Takes a column, row, dimensions, and base temperature.
+// Returns that cell of the field bench_fill draws.
+float bench_cell(int j, int i, int cols, int rows, float base)
+{
+    float x = (float)j / cols, y = (float)i / rows;
+    return base + (30.0 * sinf(x * 17.0) * cosf(y * 11.0));
+}
+
+// Takes a grid, dimensions, stride, and base temperature.
+// Fills it with a smooth field of hot and cold spots, the same every run,
+// so the renderer sees the whole color range like it would after a simulation.
+void bench_fill(float *grid, int cols, int rows, int stride, float base)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            grid[j + ((size_t)i * stride)] = bench_cell(j, i, cols, rows, base);
+        }
+    }
+}
+
+// Takes a float grid or a bf16 one (the other NULL), dimensions, stride, and heater spans.
+// Resets the grid's cells to the bench_fill field around BENCH_BASE and puts the heaters back.
+// Padding is left alone, it still holds BENCH_BASE from when the grid was made.
+void bench_seed(float *matrix, uint16_t *half, int cols, int rows, int stride, struct HeaterSpans *spans)
+{
+    if (matrix)
+    {
+        bench_fill(matrix, cols, rows, stride, BENCH_BASE);
+        heater_spans_fill(spans, matrix, stride);
+        return;
+    }
+
+    float *row = (float *)malloc(cols * sizeof(float));
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            row[j] = bench_cell(j, i, cols, rows, BENCH_BASE);
+        }
+        half_from_float(&half[(size_t)i * stride], row, cols, STORAGE_BF16);
+    }
+    free(row);
+    heater_spans_fill_half(spans, half, stride, STORAGE_BF16);
+}
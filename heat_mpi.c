@@ -0,0 +1,475 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#include <mpi.h>
+#include "heater.h"
+#include "matrix.h"
+#include "bmp.h"
+#include "heatmap.h"
+#include "stencil.h"
+
+// MPI version of heat, each process simulates a band of rows of the matrix.
+// Built separately from heat with make heat_mpi, which runs:
+//   mpicc -O2 -fopenmp -o heat_mpi heat_mpi.c matrix.c stencil.c heater.c half.c histogram.c heatmap.c bmp.c png.c -lm -lz
+//   mpirun -np 4 ./heat_mpi num_threads numRows numCols baseTemp k timesteps heaterFileName outputFileName [--halo K]
+// num_threads is OpenMP threads per process. Output matches heat run with the same arguments.
+
+#define EXPECTED_ARGS 9
+#define TRANSFER_MAX 1.1000001
+#define TRASNFER_MIN 1
+#define HALO_MAX 64
+#define WRITE_CHUNK (1 << 30) // MPI counts are ints, so big writes go out in pieces
+
+void exchange_halos(float *, int, int, int, int);
+void write_csv(float *, int, int, int, char *, int);
+void write_bmp(float *, int, int, int, int, int, float, int, char *);
+int band_start(int, int, int);
+void pack_rows(float *, float *, int, int, int);
+
+int main(int argc, char **argv)
+{
+    int provided, rank, size;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // every rank parses and validates the same arguments, but only rank 0 complains
+    int halo = 1;
+    int badArgs = argc < EXPECTED_ARGS;
+    for (int i = EXPECTED_ARGS; i < argc && !badArgs; i += 2)
+    {
+        if (i + 1 < argc && !strcmp(argv[i], "--halo"))
+            halo = atoi(argv[i + 1]);
+        else
+            badArgs = 1;
+    }
+
+    if (badArgs)
+    {
+        if (rank == 0)
+        {
+            printf("Invalid usage.\n");
+            printf("Example: mpirun -np 4 ./heat_mpi num_threads numRows numCols baseTemp k timesteps heaterFileName outputFileName [--halo K]\n");
+            printf("  --halo K   exchange K rows with each neighbor every K timesteps (1-%d, default 1)\n", HALO_MAX);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    int numThreads = atoi(argv[1]);
+    int numRows = atoi(argv[2]);
+    int numCols = atoi(argv[3]);
+    char *ptr;
+    float baseTemp = strtod(argv[4], &ptr);
+    float transferRate = strtod(argv[5], &ptr);
+    int timesteps = atoi(argv[6]);
+    char *heaterFileName = argv[7];
+    char *outFileName = argv[8];
+
+    char *error = NULL;
+    if (numThreads < 1)
+        error = "Invalid number of threads, must be >0.";
+    else if (numRows < 1 || numCols < 1)
+        error = "Invalid matrix dimensions, must be 1x1 or greater.";
+    else if (timesteps < 1)
+        error = "Invalid number of timesteps, must be >0, time can't go backwards.";
+    else if (transferRate > TRANSFER_MAX || transferRate < TRASNFER_MIN)
+        error = "Invalid heat transfer rate, choose a number between 1 and 1.1 (inclusive).";
+    else if (halo < 1 || halo > HALO_MAX)
+        error = "Invalid --halo, must be between 1 and 64.";
+    else if (numRows / size < halo)
+        error = "Too many processes or too wide a halo, every process needs at least --halo rows.";
+
+    if (error)
+    {
+        if (rank == 0)
+            printf("%s\n", error);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // every rank reads the heater file, and keeps the heaters it will ever compute
+    int heaterCount, heaterError;
+    long heaterAt;
+    struct Heater *heaters = heater_load(heaterFileName, numRows, numCols, numThreads, &heaterCount, &heaterError,
+                                         &heaterAt);
+    if (!heaters)
+    {
+        if (rank == 0)
+            heater_print_error(heaterFileName, heaterError, heaterAt);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // this rank owns rows firstRow to firstRow + ownRows - 1, and stores
+    // halo extra rows on both sides of them
+    int firstRow = band_start(numRows, rank, size);
+    int ownRows = band_start(numRows, rank + 1, size) - firstRow;
+    int localRows = ownRows + (2 * halo);
+    int stride = matrix_padded_stride(numCols);
+
+    // heaters in local rows, compiled into spans in local row numbers
+    int localCount = 0;
+    for (int n = 0; n < heaterCount; n++)
+    {
+        int row = heaters[n].row;
+        if (row >= firstRow - halo && row < firstRow + ownRows + halo)
+        {
+            heaters[localCount] = heaters[n]; // file order is kept, so duplicates land the same
+            heaters[localCount++].row -= firstRow - halo;
+        }
+    }
+    struct HeaterSpans *spans = heater_spans_init(heaters, localCount, localRows, numThreads);
+    free(heaters);
+
+    // padded, so rows past the top/bottom of the whole matrix just stay at base
+    float *matrix = matrix_init_padded(numCols, localRows, baseTemp);
+    float *tmpMatrix = matrix_init_padded(numCols, localRows, baseTemp);
+    if (!matrix || !tmpMatrix)
+    {
+        printf("ERROR: Matrix could not be allocated on process %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // local rows that exist in the whole matrix, the rest are out of bounds
+    int validStart = firstRow - halo < 0 ? halo - firstRow : 0;
+    int validEnd = firstRow + ownRows + halo > numRows ? localRows - (firstRow + ownRows + halo - numRows) : localRows;
+
+    stencil_init(); // matrix_step_block starts no threads, so the kernel is picked here
+    double start = MPI_Wtime();
+
+    heater_spans_fill(spans, matrix, stride);
+
+    // Every "halo" steps, neighbors swap "halo" rows. Each step after that, one more
+    // row on either side goes stale, so the computed band shrinks by one per step,
+    // and after the last one exactly the owned rows are left, same as the tiled engine.
+    for (int i = 0; i < timesteps; i += halo)
+    {
+        int steps = halo;
+        if (steps > timesteps - i)
+            steps = timesteps - i;
+
+        exchange_halos(matrix, stride, ownRows, halo, rank == size - 1);
+
+        for (int s = 1; s <= steps; s++)
+        {
+            int rowStart = s > validStart ? s : validStart;
+            int rowEnd = localRows - s < validEnd ? localRows - s : validEnd;
+
+            #pragma omp parallel for num_threads(numThreads) schedule(static)
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                matrix_step_block(matrix, tmpMatrix, numCols, localRows, stride, transferRate, baseTemp, 1,
+                                  r, r + 1, 0, numCols, spans, NULL, NULL);
+            }
+
+            float *tmp = matrix;
+            matrix = tmpMatrix;
+            tmpMatrix = tmp;
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
+
+    float *owned = &matrix[halo * stride];
+    write_csv(owned, numCols, ownRows, stride, outFileName, rank);
+
+    if (rank == 0)
+    {
+        printf("Heat dispersion complete on %d processes in %.3f seconds.\n", size, elapsed);
+        printf("CSV format file saved to:\t%s\n", outFileName);
+    }
+
+    write_bmp(owned, numCols, numRows, ownRows, stride, rank, baseTemp, numThreads, outFileName);
+
+    matrix_free(matrix, numCols, stride);
+    matrix_free(tmpMatrix, numCols, stride);
+    heater_spans_free(spans);
+
+    MPI_Finalize();
+    return 0;
+}
+
+// Takes the local matrix, stride, owned row count, halo width, and whether this is the last rank.
+// Sends the first/last "halo" owned rows to the neighbor above/below, and receives
+// theirs into the halo rows. Whole strides are sent, padding included, since the
+// padding is base everywhere anyway.
+void exchange_halos(float *matrix, int stride, int ownRows, int halo, int last)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int up = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+    int down = last ? MPI_PROC_NULL : rank + 1;
+    int count = halo * stride;
+
+    // owned rows start at local row "halo"
+    MPI_Sendrecv(&matrix[halo * stride], count, MPI_FLOAT, up, 0,
+                 &matrix[(halo + ownRows) * stride], count, MPI_FLOAT, down, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(&matrix[ownRows * stride], count, MPI_FLOAT, down, 1,
+                 &matrix[0], count, MPI_FLOAT, up, 1,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+// Takes this rank's owned rows, dimensions, stride, output file name, and rank.
+// Formats the rows exactly like matrix_out, then every rank writes its text at its
+// own offset of the shared file in one collective call, no rank ever holds it all.
+void write_csv(float *owned, int cols, int ownRows, int stride, char *outFileName, int rank)
+{
+    // "-1234.5," is 8 chars, anything longer is rare, so grow when needed
+    size_t capacity = ((size_t)cols * ownRows * 8) + ownRows + 64;
+    size_t len = 0;
+    char *text = (char *)malloc(capacity);
+
+    for (int i = 0; i < ownRows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            if (capacity - len < 66)
+            {
+                capacity *= 2;
+                text = (char *)realloc(text, capacity);
+            }
+            len += matrix_format_cell(&text[len], owned[j + (i * stride)], 1);
+            text[len++] = ',';
+        }
+        text[len++] = '\n';
+    }
+
+    long long mine = len, offset = 0;
+    MPI_Exscan(&mine, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0)
+        offset = 0; // Exscan leaves rank 0's result undefined
+
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, outFileName, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file))
+    {
+        if (rank == 0)
+            printf("ERROR: Output file could not be opened.\n");
+        free(text);
+        return;
+    }
+    MPI_File_set_size(file, 0); // don't leave the tail of an older, longer file behind
+
+    // collective writes need every rank to call the same number of times
+    long long most = 0, done = 0;
+    MPI_Allreduce(&mine, &most, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    for (long long written = 0; written < most; written += WRITE_CHUNK)
+    {
+        int count = 0;
+        if (done < mine)
+            count = mine - done < WRITE_CHUNK ? (int)(mine - done) : WRITE_CHUNK;
+
+        MPI_File_write_at_all(file, offset + done, &text[done], count, MPI_CHAR, MPI_STATUS_IGNORE);
+        done += count;
+    }
+
+    MPI_File_close(&file);
+    free(text);
+}
+
+// Takes the row count, a rank, and the number of ranks.
+// Returns the first row of the matrix that rank owns, the row count for rank == size.
+int band_start(int rows, int rank, int size)
+{
+    return (int)(((long)rows * rank) / size);
+}
+
+// Takes where to put the rows, the first row, row count, columns, and the rows' stride.
+// Copies the rows next to each other, leaving their padding behind.
+void pack_rows(float *dst, float *src, int count, int cols, int stride)
+{
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(&dst[(size_t)i * cols], &src[(size_t)i * stride], cols * sizeof(float));
+    }
+}
+
+// Takes this rank's owned rows, dimensions, owned row count, stride, rank,
+// base temperature, thread count, and output file name.
+// When the image is smaller than the matrix, each rank pools the image rows whose
+// cells start in its band, borrowing the few rows past its band that the last of
+// those needs from the ranks below, and only the pooled image sized grid is gathered
+// onto rank 0. Pooling a run of whole image rows cuts them the same as pooling the
+// whole matrix, so the result is what heat pools. Otherwise the matrix is no bigger
+// than the image, so gathering it whole onto rank 0 costs no more than the image does.
+void write_bmp(float *owned, int cols, int rows, int ownRows, int stride, int rank, float base, int numThreads,
+               char *outFileName)
+{
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // same sizing rules as heat
+    const int imgDim = 1024;
+    const int imgMaxMul = 5;
+    int imgW = imgDim, imgH = imgDim;
+    if (cols > rows)
+        imgW *= ((float)cols / (float)rows);
+    else if (rows > cols)
+        imgH *= ((float)rows / (float)cols);
+
+    if (imgW > imgDim * imgMaxMul || imgH > imgDim * imgMaxMul)
+    {
+        if (rank == 0)
+            printf("Image could not be generated, the matrix is too lopsided.\n");
+        return;
+    }
+
+    int pooled = cols >= imgW && rows >= imgH;
+    int cellsY = rows / imgH;
+    int extraY = rows - (cellsY * imgH);
+
+    // Rank r pools image rows imgFirst[r] to imgFirst[r + 1] - 1, which take cell
+    // rows need[r] to need[r + 1] - 1. Unpooled, every rank just sends its own rows.
+    int *imgFirst = (int *)malloc((size + 1) * sizeof(int));
+    int *need = (int *)malloc((size + 1) * sizeof(int));
+    for (int r = 0, i = 0; r <= size; r++)
+    {
+        int first = band_start(rows, r, size);
+        if (pooled)
+        {
+            while (i < imgH && heatmap_span(i, cellsY, extraY) < first)
+                i++;
+            imgFirst[r] = i;
+            need[r] = heatmap_span(i, cellsY, extraY);
+        }
+        else
+        {
+            imgFirst[r] = 0;
+            need[r] = first;
+        }
+    }
+
+    // one MPI element per matrix row, so no count ever gets near an int's limit
+    MPI_Datatype cellRow;
+    MPI_Type_contiguous(cols, MPI_FLOAT, &cellRow);
+    MPI_Type_commit(&cellRow);
+
+    float *band = NULL;
+    int bandRows = need[rank + 1] - need[rank];
+    int myFirst = band_start(rows, rank, size);
+    if (pooled)
+    {
+        // Hand every rank the rows it needs, bands and needs are both in row order.
+        // Rows this rank needs from itself are copied straight over, the rest are
+        // the few rows at the edges of bands, packed before they are sent.
+        int *sendCounts = (int *)calloc(size, sizeof(int));
+        int *sendOffsets = (int *)calloc(size, sizeof(int));
+        int *recvCounts = (int *)calloc(size, sizeof(int));
+        int *recvOffsets = (int *)calloc(size, sizeof(int));
+        band = (float *)malloc((size_t)cols * bandRows * sizeof(float));
+
+        int sendRows = 0;
+        for (int r = 0; r < size; r++)
+        {
+            int lo = need[r] > myFirst ? need[r] : myFirst;
+            int hi = need[r + 1] < myFirst + ownRows ? need[r + 1] : myFirst + ownRows;
+            if (hi > lo && r != rank)
+            {
+                sendCounts[r] = hi - lo;
+                sendOffsets[r] = sendRows;
+                sendRows += hi - lo;
+            }
+            else if (hi > lo)
+            {
+                pack_rows(&band[(size_t)(lo - need[rank]) * cols], &owned[(size_t)(lo - myFirst) * stride],
+                          hi - lo, cols, stride);
+            }
+
+            int theirFirst = band_start(rows, r, size);
+            int theirEnd = band_start(rows, r + 1, size);
+            lo = need[rank] > theirFirst ? need[rank] : theirFirst;
+            hi = need[rank + 1] < theirEnd ? need[rank + 1] : theirEnd;
+            if (hi > lo && r != rank)
+            {
+                recvCounts[r] = hi - lo;
+                recvOffsets[r] = lo - need[rank];
+            }
+        }
+
+        float *sendBuf = (float *)malloc((size_t)cols * sendRows * sizeof(float));
+        for (int r = 0; r < size; r++)
+        {
+            int lo = need[r] > myFirst ? need[r] : myFirst;
+            if (sendCounts[r])
+                pack_rows(&sendBuf[(size_t)sendOffsets[r] * cols], &owned[(size_t)(lo - myFirst) * stride],
+                          sendCounts[r], cols, stride);
+        }
+
+        MPI_Alltoallv(sendBuf, sendCounts, sendOffsets, cellRow, band, recvCounts, recvOffsets, cellRow,
+                      MPI_COMM_WORLD);
+        free(sendBuf);
+        free(sendCounts);
+        free(sendOffsets);
+        free(recvCounts);
+        free(recvOffsets);
+    }
+
+    // what gets gathered, the pooled image rows or the rows themselves without their padding
+    int outW = pooled ? imgW : cols;
+    int outRows = pooled ? imgFirst[rank + 1] - imgFirst[rank] : ownRows;
+    float *out = (float *)malloc((size_t)outW * outRows * sizeof(float));
+    if (pooled)
+    {
+        if (outRows > 0)
+            pool_map_float(band, cols, bandRows, cols, imgW, outRows, POOL_MEAN, numThreads, out);
+        free(band);
+    }
+    else
+    {
+        pack_rows(out, owned, ownRows, cols, stride);
+    }
+
+    int *counts = NULL, *offsets = NULL;
+    float *whole = NULL;
+    int wholeRows = pooled ? imgH : rows;
+    if (rank == 0)
+    {
+        counts = (int *)malloc(size * sizeof(int));
+        offsets = (int *)malloc(size * sizeof(int));
+        whole = (float *)malloc((size_t)outW * wholeRows * sizeof(float));
+        for (int r = 0; r < size; r++)
+        {
+            int first = pooled ? imgFirst[r] : band_start(rows, r, size);
+            int next = pooled ? imgFirst[r + 1] : band_start(rows, r + 1, size);
+            counts[r] = next - first;
+            offsets[r] = first;
+        }
+    }
+
+    MPI_Datatype outRow;
+    MPI_Type_contiguous(outW, MPI_FLOAT, &outRow);
+    MPI_Type_commit(&outRow);
+    MPI_Gatherv(out, outRows, outRow, whole, counts, offsets, outRow, 0, MPI_COMM_WORLD);
+
+    MPI_Type_free(&outRow);
+    MPI_Type_free(&cellRow);
+    free(out);
+    free(imgFirst);
+    free(need);
+
+    if (rank != 0)
+        return;
+
+    unsigned char colors[] = {255, 224, 122,
+                              96, 204, 143,
+                              94, 84, 235};
+    char *outImgName = (char *)malloc(strlen(outFileName) + 5);
+    strcpy(outImgName, outFileName);
+    strcat(outImgName, ".bmp");
+
+    // pooled, one value per pixel is left and it is colored as is
+    if (generate_bmp_float(whole, outW, wholeRows, outW, imgW, imgH, base, 25.0, colors, POOL_MEAN, numThreads,
+                           outImgName))
+        printf("ERROR: BMP heatmap image could not be written to %s.\n", outImgName);
+    else
+        printf("BMP heatmap image saved to:\t%s\n", outImgName);
+
+    free(outImgName);
+    free(whole);
+    free(counts);
+    free(offsets);
+}
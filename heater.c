@@ -1,62 +1,526 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "heater.h"
+#include "half.h"
 
-#define READ_BUFFER 1024
+#define TOKEN_MAX 64 // longest row, col, or temp a text file may use
 
-// Reads the first line of the named file into a buffer,
-// the first line is always the number of heaters,
-// and returns that number as an int.
-int get_heater_count(char *heaterFileName)
+_Static_assert(sizeof(struct Heater) == 12, "binary heater files store heaters exactly as struct Heater");
+_Static_assert(sizeof(struct HeaterFileHeader) == 16, "binary heater file header must stay 16 bytes");
+
+struct Heater *heater_load_binary(char *, size_t, int *, int *, long *);
+struct Heater *heater_load_text(char *, size_t, int, int *, int *, long *);
+int heater_parse_line(char **, char *, struct Heater *);
+int heater_token(char **, char *, char *);
+long heater_validate(struct Heater *, int, int, int, int);
+int heater_key_compare(const void *, const void *);
+
+// a heater's place in a row while sorting, file order breaks ties between duplicates
+struct HeaterKey
 {
-    FILE *heaterFile;
-    heaterFile = fopen(heaterFileName, "r");
-    char buffer[READ_BUFFER]; // byte buffer to store the first line in
+    int col;
+    int n;
+};
+
+// Takes the heater file's name, the matrix dimensions to check heaters against (0 rows
+// to skip the check), thread count, and where to put the heater count, a HEATER_* error,
+// and the heater number (from 1) the error is about, if any.
+// Maps the file and reads it in one pass. Binary files (see HeaterFileHeader) are copied
+// out as they are, text files, a count on the first line then a "row col temp" line per
+// heater, are split into line-aligned chunks and parsed on up to numThreads threads.
+// Returns the heaters, or NULL with error set. Free with free().
+struct Heater *heater_load(char *fileName, int rows, int cols, int numThreads, int *count, int *error, long *where)
+{
+    *count = 0;
+    *where = 0;
+
+    int fd = open(fileName, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+    {
+        if (fd >= 0)
+            close(fd);
+        *error = HEATER_NO_FILE;
+        return NULL;
+    }
 
-    fgets(buffer, READ_BUFFER, heaterFile); // first line (by new line char) contains number of heaters
-    int numHeaters = atoi(buffer);   // aka number of lines to read
+    size_t size = st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        *error = HEATER_EMPTY;
+        return NULL;
+    }
+
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED)
+    {
+        *error = HEATER_NO_FILE;
+        return NULL;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    struct Heater *heaters;
+    if (size >= sizeof(struct HeaterFileHeader) && !memcmp(map, HEATERFILE_MAGIC, 8))
+        heaters = heater_load_binary(map, size, count, error, where);
+    else
+        heaters = heater_load_text(map, size, numThreads, count, error, where);
+    munmap(map, size);
+
+    if (heaters && rows > 0)
+    {
+        long bad = heater_validate(heaters, *count, rows, cols, numThreads);
+        if (bad)
+        {
+            free(heaters);
+            *error = HEATER_OUT_OF_GRID;
+            *where = bad;
+            return NULL;
+        }
+    }
 
-    fclose(heaterFile);
-    return numHeaters;
+    return heaters;
 }
 
-// Takes file name and number of heaters,
-// returns null if no heaters, and parses each line of the file
-// given by the number of heaters into ints coordinates and float temp.
-// Returns heater struct with heater data.
-struct Heater *get_heaters(char *heaterFileName, int numHeaters)
+// Takes the heater file's name, and the error and heater number from heater_load.
+// Prints what went wrong, and where.
+void heater_print_error(char *fileName, int error, long where)
 {
-    if (!numHeaters)
+    const char *what = "unknown error";
+    switch (error)
+    {
+        case HEATER_NO_FILE: what = "file could not be opened"; break;
+        case HEATER_EMPTY: what = "no heaters in file"; break;
+        case HEATER_SHORT: what = "file ends with fewer heaters than its count"; break;
+        case HEATER_BAD_LINE: what = "not a \"row col temp\" line"; break;
+        case HEATER_OUT_OF_GRID: what = "outside the matrix"; break;
+        case HEATER_VERSION: what = "binary heater file version this build can't read"; break;
+        case HEATER_NO_MEMORY: what = "not enough memory for the heaters"; break;
+    }
+
+    if (where)
+        printf("ERROR: Heaters could not be loaded from %s, heater %ld: %s.\n", fileName, where, what);
+    else
+        printf("ERROR: Heaters could not be loaded from %s: %s.\n", fileName, what);
+}
+
+// Takes a mapped binary heater file, its size, and where to put the count, error and heater number.
+// Checks the header and size, then copies the heaters out with no parsing at all.
+// Returns the heaters, or NULL with error set.
+struct Heater *heater_load_binary(char *map, size_t size, int *count, int *error, long *where)
+{
+    struct HeaterFileHeader header;
+    memcpy(&header, map, sizeof(header));
+
+    if (header.version != HEATERFILE_VERSION)
+    {
+        *error = HEATER_VERSION;
+        return NULL;
+    }
+    if (header.count == 0 || header.count > 0x7fffffff)
     {
+        *error = HEATER_EMPTY;
         return NULL;
     }
 
-    FILE *heaterFile;
-    heaterFile = fopen(heaterFileName, "r"); // r for read only
-    char buffer[READ_BUFFER];
+    size_t available = (size - sizeof(header)) / sizeof(struct Heater);
+    if (available < header.count)
+    {
+        *error = HEATER_SHORT;
+        *where = available + 1;
+        return NULL;
+    }
 
-    struct Heater *heaters = malloc(sizeof(struct Heater) * numHeaters); // Allocate room for all heaters in file
-    fscanf(heaterFile, "%s", buffer);
-    for (int i = 0; i < numHeaters; i++)
+    struct Heater *heaters = (struct Heater *)malloc(header.count * sizeof(struct Heater));
+    if (!heaters)
     {
-        fscanf(heaterFile, "%s", buffer);
-        int row = atoi(buffer);
+        *error = HEATER_NO_MEMORY;
+        return NULL;
+    }
+    memcpy(heaters, map + sizeof(header), header.count * sizeof(struct Heater));
 
-        fscanf(heaterFile, "%s", buffer);
-        int col = atoi(buffer);
+    *count = header.count;
+    *error = HEATER_OK;
+    return heaters;
+}
 
-        fscanf(heaterFile, "%s", buffer);
-        char *ptr;
-        float t = strtod(buffer, &ptr);
+// Takes a mapped text heater file, its size, thread count, and where to put the count,
+// error and heater number.
+// Each thread parses whole lines of its own chunk into its own list, and the lists are
+// joined in file order. Lines past the count on the first line are ignored, like before.
+// Returns the heaters, or NULL with error set.
+struct Heater *heater_load_text(char *map, size_t size, int numThreads, int *count, int *error, long *where)
+{
+    char *end = map + size;
+    char *body = memchr(map, '\n', size);
+    body = body ? body + 1 : end;
+
+    // the count is the first token of the first line
+    char token[TOKEN_MAX];
+    char *pos = map;
+    char *ptr;
+    long expected = heater_token(&pos, body, token) ? strtol(token, &ptr, 10) : 0;
+    if (expected <= 0 || expected > 0x7fffffff)
+    {
+        *error = HEATER_EMPTY;
+        return NULL;
+    }
+
+    size_t bodyLen = end - body;
+    int numChunks = bodyLen / HEATER_CHUNK_MIN;
+    if (numChunks > numThreads)
+        numChunks = numThreads;
+    if (numChunks < 1)
+        numChunks = 1;
+
+    // chunk c runs from just after the line break at or past its even share's start
+    char **chunkStart = (char **)malloc((numChunks + 1) * sizeof(char *));
+    for (int c = 0; c <= numChunks; c++)
+    {
+        char *start = body + ((bodyLen * c) / numChunks);
+        if (c > 0 && c < numChunks && start[-1] != '\n')
+        {
+            char *brk = memchr(start, '\n', end - start);
+            start = brk ? brk + 1 : end;
+        }
+        chunkStart[c] = start;
+    }
+
+    struct Heater **lists = (struct Heater **)calloc(numChunks, sizeof(struct Heater *));
+    long *listLen = (long *)calloc(numChunks, sizeof(long));
+    long *listBad = (long *)malloc(numChunks * sizeof(long)); // first bad line in the chunk, -1 for none
+
+    #pragma omp parallel for num_threads(numChunks) schedule(static, 1)
+    for (int c = 0; c < numChunks; c++)
+    {
+        long cap = 1024, len = 0;
+        struct Heater *list = (struct Heater *)malloc(cap * sizeof(struct Heater));
+        char *line = chunkStart[c];
+        listBad[c] = -1;
+
+        // a bad line only matters if it comes before the count runs out, so keep going
+        // past it, the next chunk's heaters still need numbering
+        while (line < chunkStart[c + 1] && len < expected)
+        {
+            char *lineEnd = memchr(line, '\n', chunkStart[c + 1] - line);
+            lineEnd = lineEnd ? lineEnd : chunkStart[c + 1];
+
+            if (len == cap)
+            {
+                cap *= 2;
+                list = (struct Heater *)realloc(list, cap * sizeof(struct Heater));
+            }
+
+            int parsed = heater_parse_line(&line, lineEnd, &list[len]);
+            if (parsed < 0 && listBad[c] < 0)
+                listBad[c] = len;
+            if (parsed)
+                len++;
+
+            line = lineEnd + 1;
+        }
+
+        lists[c] = list;
+        listLen[c] = len;
+    }
 
-        struct Heater tmp;
-        tmp.row = row;
-        tmp.col = col;
-        tmp.temp = t;
+    // Count what the lists hold up to the count, or the first bad line before it,
+    // so a short or broken file is reported before the count decides how much to allocate.
+    long total = 0;
+    *error = HEATER_OK;
+    for (int c = 0; c < numChunks && total < expected && *error == HEATER_OK; c++)
+    {
+        long take = listLen[c] < expected - total ? listLen[c] : expected - total;
+        if (listBad[c] >= 0 && listBad[c] < take)
+        {
+            *error = HEATER_BAD_LINE;
+            *where = total + listBad[c] + 1;
+        }
+        total += take;
+    }
+    if (*error == HEATER_OK && total < expected)
+    {
+        *error = HEATER_SHORT;
+        *where = total + 1;
+    }
 
-        heaters[i] = tmp;
+    // then join them in order
+    struct Heater *heaters = NULL;
+    if (*error == HEATER_OK && !(heaters = (struct Heater *)malloc(expected * sizeof(struct Heater))))
+        *error = HEATER_NO_MEMORY;
+    for (long c = 0, joined = 0; heaters && joined < expected; c++)
+    {
+        long take = listLen[c] < expected - joined ? listLen[c] : expected - joined;
+        memcpy(&heaters[joined], lists[c], take * sizeof(struct Heater));
+        joined += take;
     }
 
-    fclose(heaterFile);
+    for (int c = 0; c < numChunks; c++)
+        free(lists[c]);
+    free(lists);
+    free(listLen);
+    free(listBad);
+    free(chunkStart);
+
+    if (*error != HEATER_OK)
+        return NULL;
+
+    *count = expected;
     return heaters;
-}
\ No newline at end of file
+}
+
+// Takes where the line starts, where it ends, and the heater to fill in.
+// Returns 1 for a heater, 0 for a blank line, -1 for anything else. A bad line still
+// takes up a heater's place, so the heaters after it keep their numbers.
+int heater_parse_line(char **pos, char *end, struct Heater *heater)
+{
+    char row[TOKEN_MAX], col[TOKEN_MAX], temp[TOKEN_MAX], extra[TOKEN_MAX];
+    char *rowEnd, *colEnd, *tempEnd;
+
+    if (!heater_token(pos, end, row))
+        return 0;
+
+    if (!heater_token(pos, end, col) || !heater_token(pos, end, temp) || heater_token(pos, end, extra))
+        return -1;
+
+    heater->row = strtol(row, &rowEnd, 10);
+    heater->col = strtol(col, &colEnd, 10);
+    heater->temp = strtod(temp, &tempEnd);
+
+    return *rowEnd || *colEnd || *tempEnd ? -1 : 1;
+}
+
+// Takes where to read from, the end of the line, and a TOKEN_MAX buffer.
+// Skips whitespace, then copies one whitespace separated token into the buffer,
+// always terminated, cut short if too long (which then fails to parse).
+// Returns the token's length, 0 if the line ran out first.
+int heater_token(char **pos, char *end, char *buf)
+{
+    char *p = *pos;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+
+    int len = 0;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+    {
+        if (len < TOKEN_MAX - 1)
+            buf[len] = *p;
+        len++;
+        p++;
+    }
+    buf[len < TOKEN_MAX - 1 ? len : TOKEN_MAX - 1] = '\0';
+    if (len >= TOKEN_MAX - 1)
+        buf[0] = '!'; // too long for any real number, make sure it fails to parse
+
+    *pos = p;
+    return len;
+}
+
+// Takes the heaters, count, matrix dimensions, and thread count.
+// Returns the number (from 1) of the first heater outside the matrix, 0 if they all fit.
+long heater_validate(struct Heater *heaters, int count, int rows, int cols, int numThreads)
+{
+    long first = count;
+
+    #pragma omp parallel for num_threads(numThreads) schedule(static) reduction(min:first)
+    for (int i = 0; i < count; i++)
+    {
+        if (heaters[i].row < 0 || heaters[i].row >= rows || heaters[i].col < 0 || heaters[i].col >= cols)
+            first = i < first ? i : first;
+    }
+
+    return first < count ? first + 1 : 0;
+}
+
+// Takes heaters (all inside the matrix, see heater_load), their count, the matrix's
+// row count, and thread count.
+// Buckets the heaters by row with a counting sort, which keeps file order inside each
+// row, then sorts every row by column on its own. Of several heaters on one cell only
+// the last in the file is kept, and neighbors on a row are merged into one span.
+// Returns the spans, free with heater_spans_free.
+struct HeaterSpans *heater_spans_init(struct Heater *heaters, int count, int rows, int numThreads)
+{
+    struct HeaterSpans *spans = (struct HeaterSpans *)malloc(sizeof(*spans));
+    spans->rows = rows;
+    spans->rowStart = (int *)calloc(rows + 1, sizeof(int));
+
+    int *rowFirst = (int *)calloc(rows + 1, sizeof(int));
+    for (int n = 0; n < count; n++)
+    {
+        rowFirst[heaters[n].row + 1]++;
+    }
+    for (int r = 0; r < rows; r++)
+    {
+        rowFirst[r + 1] += rowFirst[r];
+    }
+
+    struct HeaterKey *keys = (struct HeaterKey *)malloc((count + 1) * sizeof(struct HeaterKey));
+    int *fill = (int *)malloc((rows + 1) * sizeof(int));
+    memcpy(fill, rowFirst, rows * sizeof(int));
+    for (int n = 0; n < count; n++)
+    {
+        struct HeaterKey *key = &keys[fill[heaters[n].row]++];
+        key->col = heaters[n].col;
+        key->n = n;
+    }
+    free(fill);
+
+    // sort and deduplicate each row in place, counting its cells and spans
+    int *rowCells = (int *)calloc(rows + 1, sizeof(int));
+
+    #pragma omp parallel for num_threads(numThreads) schedule(dynamic, 64)
+    for (int r = 0; r < rows; r++)
+    {
+        struct HeaterKey *row = &keys[rowFirst[r]];
+        int len = rowFirst[r + 1] - rowFirst[r];
+        if (len == 0)
+            continue;
+
+        qsort(row, len, sizeof(struct HeaterKey), heater_key_compare);
+
+        int cells = 0, runs = 0;
+        for (int h = 0; h < len; h++)
+        {
+            // a later duplicate overwrites the one before it
+            if (cells > 0 && row[cells - 1].col == row[h].col)
+            {
+                row[cells - 1] = row[h];
+                continue;
+            }
+
+            if (cells == 0 || row[cells - 1].col + 1 != row[h].col)
+                runs++;
+            row[cells++] = row[h];
+        }
+
+        rowCells[r + 1] = cells;
+        spans->rowStart[r + 1] = runs;
+    }
+
+    for (int r = 0; r < rows; r++)
+    {
+        rowCells[r + 1] += rowCells[r];
+        spans->rowStart[r + 1] += spans->rowStart[r];
+    }
+
+    spans->cells = rowCells[rows];
+    spans->span = (struct HeaterSpan *)malloc((spans->rowStart[rows] + 1) * sizeof(struct HeaterSpan));
+    spans->temps = (float *)malloc((spans->cells + 1) * sizeof(float));
+
+    #pragma omp parallel for num_threads(numThreads) schedule(dynamic, 64)
+    for (int r = 0; r < rows; r++)
+    {
+        struct HeaterKey *row = &keys[rowFirst[r]];
+        int cells = rowCells[r + 1] - rowCells[r];
+        int s = spans->rowStart[r] - 1;
+
+        for (int h = 0; h < cells; h++)
+        {
+            if (h == 0 || row[h - 1].col + 1 != row[h].col)
+            {
+                s++;
+                spans->span[s].col = row[h].col;
+                spans->span[s].len = 0;
+                spans->span[s].temp = rowCells[r] + h;
+            }
+            spans->span[s].len++;
+            spans->temps[rowCells[r] + h] = heaters[row[h].n].temp;
+        }
+    }
+
+    free(keys);
+    free(rowFirst);
+    free(rowCells);
+
+    return spans;
+}
+
+// Orders heater keys by column, then by place in the file.
+int heater_key_compare(const void *a, const void *b)
+{
+    const struct HeaterKey *x = (const struct HeaterKey *)a;
+    const struct HeaterKey *y = (const struct HeaterKey *)b;
+
+    if (x->col != y->col)
+        return x->col < y->col ? -1 : 1;
+    return x->n < y->n ? -1 : (x->n > y->n);
+}
+
+// Takes the spans, a row, and a column.
+// Returns the first span of the row that ends past that column, rowStart[row + 1] if none.
+int heater_spans_find(struct HeaterSpans *spans, int row, int col)
+{
+    int lo = spans->rowStart[row];
+    int hi = spans->rowStart[row + 1];
+
+    while (lo < hi)
+    {
+        int mid = lo + ((hi - lo) / 2);
+        if (spans->span[mid].col + spans->span[mid].len <= col)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// Takes the spans, a row, columns colStart to colEnd-1, and that row of a matrix
+// (pointing at column 0).
+// Places the row's heaters that fall in those columns.
+void heater_spans_row(struct HeaterSpans *spans, int row, int colStart, int colEnd, float *dest)
+{
+    for (int s = heater_spans_find(spans, row, colStart);
+         s < spans->rowStart[row + 1] && spans->span[s].col < colEnd; s++)
+    {
+        struct HeaterSpan *span = &spans->span[s];
+        int start = span->col > colStart ? span->col : colStart;
+        int end = span->col + span->len < colEnd ? span->col + span->len : colEnd;
+
+        memcpy(&dest[start], &spans->temps[span->temp + (start - span->col)], (end - start) * sizeof(float));
+    }
+}
+
+// Takes the spans, a matrix and its row stride.
+// Places every heater, for a matrix that has not been through a step yet.
+void heater_spans_fill(struct HeaterSpans *spans, float *matrix, int stride)
+{
+    for (int r = 0; r < spans->rows; r++)
+    {
+        for (int s = spans->rowStart[r]; s < spans->rowStart[r + 1]; s++)
+        {
+            memcpy(&matrix[spans->span[s].col + ((size_t)r * stride)], &spans->temps[spans->span[s].temp],
+                   spans->span[s].len * sizeof(float));
+        }
+    }
+}
+
+// Same as heater_spans_fill, for a 16 bit matrix in a STORAGE_* format (see half.h).
+void heater_spans_fill_half(struct HeaterSpans *spans, uint16_t *matrix, int stride, int format)
+{
+    for (int r = 0; r < spans->rows; r++)
+    {
+        for (int s = spans->rowStart[r]; s < spans->rowStart[r + 1]; s++)
+        {
+            half_from_float(&matrix[spans->span[s].col + ((size_t)r * stride)], &spans->temps[spans->span[s].temp],
+                            spans->span[s].len, format);
+        }
+    }
+}
+
+void heater_spans_free(struct HeaterSpans *spans)
+{
+    if (!spans)
+        return;
+
+    free(spans->rowStart);
+    free(spans->span);
+    free(spans->temps);
+    free(spans);
+}
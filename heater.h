@@ -1,8 +1,21 @@
 #ifndef UTIL_H
 #define UTIL_H
 
-int get_heater_count(char *);
-struct Heater *get_heaters(char *, int);
+#include <stdint.h>
+
+#define HEATERFILE_MAGIC "HEATERS\0" // binary heater files start with this, text ones with a count
+#define HEATERFILE_VERSION 1
+#define HEATER_CHUNK_MIN (1 << 20)   // fewest bytes of a text file worth giving a thread of its own
+
+// what heater_load found wrong, see heater_print_error
+#define HEATER_OK 0
+#define HEATER_NO_FILE 1     // missing or unreadable
+#define HEATER_EMPTY 2       // a count of 0, or no count at all
+#define HEATER_SHORT 3       // fewer heaters than the count says
+#define HEATER_BAD_LINE 4    // a line that isn't row col temp
+#define HEATER_OUT_OF_GRID 5 // row or col outside the matrix
+#define HEATER_VERSION 6     // a binary file of a HEATERFILE_VERSION this build can't read
+#define HEATER_NO_MEMORY 7   // the heaters didn't fit in memory
 
 struct Heater
 {
@@ -11,4 +24,43 @@ struct Heater
     float temp;
 };
 
-#endif
\ No newline at end of file
+// Binary heater file, this header then count heaters, each exactly a struct Heater
+// (int32 row, int32 col, float temp, little endian, 12 bytes, no padding).
+struct HeaterFileHeader
+{
+    char magic[8];       // HEATERFILE_MAGIC
+    uint32_t version;    // HEATERFILE_VERSION
+    uint32_t count;
+};
+
+// A run of heaters on adjacent cells of one row.
+struct HeaterSpan
+{
+    int col;  // first column
+    int len;  // cells
+    int temp; // temperatures are temps[temp] to temps[temp + len - 1]
+};
+
+// Heaters compiled for stepping, sorted by row then column, with duplicates resolved
+// the way placing them in file order would (the last one wins). Step functions copy
+// a span's temperatures straight into the new matrix instead of computing those cells.
+struct HeaterSpans
+{
+    int rows;
+    int *rowStart;           // spans of row r are span[rowStart[r]] to span[rowStart[r + 1] - 1]
+    struct HeaterSpan *span; // left to right within a row
+    float *temps;
+    int cells;               // distinct heater cells
+};
+
+struct Heater *heater_load(char *, int, int, int, int *, int *, long *);
+void heater_print_error(char *, int, long);
+
+struct HeaterSpans *heater_spans_init(struct Heater *, int, int, int);
+int heater_spans_find(struct HeaterSpans *, int, int);
+void heater_spans_row(struct HeaterSpans *, int, int, int, float *);
+void heater_spans_fill(struct HeaterSpans *, float *, int);
+void heater_spans_fill_half(struct HeaterSpans *, uint16_t *, int, int);
+void heater_spans_free(struct HeaterSpans *);
+
+#endif
@@ -1,12 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "heater.h"
 
 int main(int argc, char **argv)
 {
-    if (argc != 7)
+    if (argc != 7 && argc != 8)
     {
-        printf("Invalid arguments, correct usage: heatergen numHeaters tempMin tempMax height width fileName\n");
+        printf("Invalid arguments, correct usage: heatergen numHeaters tempMin tempMax height width fileName [text|binary]\n");
         return 1;
     }
 
@@ -17,12 +19,47 @@ int main(int argc, char **argv)
     int height = atoi(argv[4]);
     int width = atoi(argv[5]);
     char *outFileName = argv[6];
+    int binary = argc == 8 && !strcmp(argv[7], "binary");
 
-    FILE *outFile = fopen(outFileName, "w");
-    fprintf(outFile, "%d\n", numHeaters);
+    if (argc == 8 && !binary && strcmp(argv[7], "text"))
+    {
+        printf("Invalid format %s, must be text or binary\n", argv[7]);
+        return 1;
+    }
+
+    FILE *outFile = fopen(outFileName, binary ? "wb" : "w");
+    if (outFile == NULL)
+    {
+        printf("ERROR: Could not open %s\n", outFileName);
+        return 1;
+    }
 
     srand(time(NULL));
 
+    if (binary)
+    {
+        // heat reads these straight into memory, see HeaterFileHeader
+        struct HeaterFileHeader header;
+        memcpy(header.magic, HEATERFILE_MAGIC, sizeof(header.magic));
+        header.version = HEATERFILE_VERSION;
+        header.count = numHeaters;
+        fwrite(&header, sizeof(header), 1, outFile);
+
+        for (int i = 0; i < numHeaters; i++)
+        {
+            struct Heater heater;
+            heater.row = rand() % height;
+            heater.col = rand() % width;
+            heater.temp = (((float)rand() / (float)RAND_MAX) * (tempMax - tempMin)) + tempMin;
+            fwrite(&heater, sizeof(heater), 1, outFile);
+        }
+
+        fclose(outFile);
+        return 0;
+    }
+
+    fprintf(outFile, "%d\n", numHeaters);
+
     for (int i = 0; i < numHeaters; i++)
     {
         fprintf(outFile, "%d %d %f\n", rand() % height, 
@@ -32,4 +69,4 @@ int main(int argc, char **argv)
     fclose(outFile);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,65 +1,70 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <stdio.h>
 #include "heatmap.h"
+#include "bmp.h"
+#include "png.h"
 
-unsigned char *heatmap_gen(Matrix *, int, int, unsigned char *);
+unsigned char *heatmap_gen(Matrix *, int, int, unsigned char *, int, int, unsigned char *, long);
 
-void generate_cells_per_pixel(Matrix *, Map *);
-void generate_pixels_per_cell(Matrix *, Map *);
+Matrix *init_matrix(void *, int, int, int, double, double);
+Map *init_map(int, int, int, unsigned char *, int, int, unsigned char *, long, double);
 
-void fill_pixels(Map *, Matrix *, int, int, int, int, int);
-Color avg_cell_chunk(Matrix *, Map *, int, int, int, int);
-
-Matrix *init_matrix(void *, int, int, long double, long double);
-Map *init_map(int, int, int, unsigned char *);
-
-int bind(int, int, int);
 Color lerp(Color, Color, float);
-
-// for use as function pointers, to support multiple numeric types
-long double relative_val_float(Matrix *, const int);
-long double relative_val_int(Matrix *, const int);
-long double relative_val_double(Matrix *, const int);
-long double relative_val_long(Matrix *, const int);
-
-// Places data type matters:
-// fill_pixels    : relativeTemp, t, maybe range
-//                  store relative temp, t, and range as doubles? and cast to needed type?
-//                  should work for ints, chars, floats, and doubles.
-//                  then just have functions to do the necessary casted calcs.
-//
-// avg_cell_chunk : relativeTemp, t, maybe range
-//                  same as above, should work hopefully
-//
-// bind           : data type being bound, might be deprecated though
-//                  just dont use bind :)
-
-// TODO: Improve performance, minimize casting, it runs a bit slow at the moment.
-//       Maybe multithreading, also just optimizing function ptr usage.
+void build_lut(Color *, int, Color *, int);
+Color lut_color(Map *, float);
+
+// Render kernels, one full copy per supported element type, stamped out from
+// heatmap_kernel.h: generate_cells_per_pixel_float, generate_pixels_per_cell_int, ...
+// Each reads its own type directly, so there is no per-cell function pointer,
+// and colors come from the map's lookup table.
+#define HEATMAP_TYPE float
+#define HEATMAP_DIFF float
+#define HEATMAP_NAME float
+#include "heatmap_kernel.h"
+
+#define HEATMAP_TYPE int
+#define HEATMAP_DIFF double
+#define HEATMAP_NAME int
+#include "heatmap_kernel.h"
+
+#define HEATMAP_TYPE double
+#define HEATMAP_DIFF double
+#define HEATMAP_NAME double
+#include "heatmap_kernel.h"
+
+#define HEATMAP_TYPE long
+#define HEATMAP_DIFF double
+#define HEATMAP_NAME long
+#include "heatmap_kernel.h"
 
 // TODO: Make user defined color schemes more intuitive.
 //       having to make a 9 element array kind of sucks, and
 //       also sucks to unpack it.
-unsigned char *heatmap_gen(Matrix *data, int imgW, int imgH, unsigned char *colors)
+// dest and pitch say where the pixels go (see render_map_float), a NULL dest allocates
+// a packed top-down image instead. pool is a POOL_* mode for images smaller than the
+// matrix, and numThreads threads share the rows.
+unsigned char *heatmap_gen(Matrix *data, int imgW, int imgH, unsigned char *colors, int pool, int numThreads, unsigned char *dest, long pitch)
 {
-    Map *dataMap = init_map(imgW, imgH, BPP, colors);
+    Map *dataMap = init_map(imgW, imgH, BPP, colors, pool, numThreads, dest, pitch, data->range);
 
     // Two methods of heatmap generation, one for matrix > img, another for img > matrix
     // One has multiple cells in matrix per pixel ("chunk" of cells per pixel)
     // The other has multiple pixel per cell in matrix (inverse "chunk" of pixels per cell)
     if (data->cols >= imgW && data->rows >= imgH)
     {
-        // image will be smaller than matrix, each color being an average of cells
-        generate_cells_per_pixel(data, dataMap);
+        // image will be smaller than matrix, each color being a pooled chunk of cells
+        data->cells_per_pixel(data, dataMap);
     }
     else
     {
         // image will be larger than matrix, each cell having multiple pixels in the output
-        generate_pixels_per_cell(data, dataMap);
+        data->pixels_per_cell(data, dataMap);
     }
 
     unsigned char *final_map = dataMap->map;
+    free(dataMap->lut);
     free(dataMap);
 
     return final_map;
@@ -67,75 +72,191 @@ unsigned char *heatmap_gen(Matrix *data, int imgW, int imgH, unsigned char *colo
 
 //
 /* Type specifying initial function, these are what the user calls in their code. */
-/* This tells the functions doing the work what type to expect, via function ptr. */
+/* This picks the render kernels built for that type.                            */
 //
-unsigned char *generate_map_float(float *arr, int cols, int rows, int imgW, int imgH, float base, float range, unsigned char *colors)
+unsigned char *generate_map_float(float *arr, int cols, int rows, int stride, int imgW, int imgH, float base, float range, unsigned char *colors, int pool, int numThreads)
 {
-    Matrix *data = init_matrix(arr, cols, rows, base, range);
-    data->get_relative_val = relative_val_float;
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_float;
+    data->pixels_per_cell = generate_pixels_per_cell_float;
 
-    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors);
+    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors, pool, numThreads, NULL, 0);
 
     free(data);
     return final_map;
 }
 
-unsigned char *generate_map_int(int *arr, int cols, int rows, int imgW, int imgH, int base, int range, unsigned char *colors)
+unsigned char *generate_map_int(int *arr, int cols, int rows, int stride, int imgW, int imgH, int base, int range, unsigned char *colors, int pool, int numThreads)
 {
-    Matrix *data = init_matrix(arr, cols, rows, base, range);
-    data->get_relative_val = relative_val_int;
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_int;
+    data->pixels_per_cell = generate_pixels_per_cell_int;
 
-    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors);
+    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors, pool, numThreads, NULL, 0);
 
     free(data);
     return final_map;
 }
 
-unsigned char *generate_map_double(double *arr, int cols, int rows, int imgW, int imgH, double base, double range, unsigned char *colors)
+unsigned char *generate_map_double(double *arr, int cols, int rows, int stride, int imgW, int imgH, double base, double range, unsigned char *colors, int pool, int numThreads)
 {
-    Matrix *data = init_matrix(arr, cols, rows, base, range);
-    data->get_relative_val = relative_val_double;
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_double;
+    data->pixels_per_cell = generate_pixels_per_cell_double;
 
-    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors);
+    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors, pool, numThreads, NULL, 0);
 
     free(data);
     return final_map;
 }
 
-unsigned char *generate_map_long(long *arr, int cols, int rows, int imgW, int imgH, long base, long range, unsigned char *colors)
+unsigned char *generate_map_long(long *arr, int cols, int rows, int stride, int imgW, int imgH, long base, long range, unsigned char *colors, int pool, int numThreads)
 {
-    Matrix *data = init_matrix(arr, cols, rows, base, range);
-    data->get_relative_val = relative_val_long;
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_long;
+    data->pixels_per_cell = generate_pixels_per_cell_long;
 
-    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors);
+    unsigned char *final_map = heatmap_gen(data, imgW, imgH, colors, pool, numThreads, NULL, 0);
 
     free(data);
     return final_map;
 }
 
+//
+/* Same as above, but drawing into a buffer the caller already has, dest being the */
+/* first pixel of the top image row and pitch the bytes from one row to the next. */
+/* A negative pitch draws bottom-up, straight into a BMP's pixel array.          */
+//
+void render_map_float(float *arr, int cols, int rows, int stride, int imgW, int imgH, float base, float range, unsigned char *colors, int pool, int numThreads, unsigned char *dest, long pitch)
+{
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_float;
+    data->pixels_per_cell = generate_pixels_per_cell_float;
+
+    heatmap_gen(data, imgW, imgH, colors, pool, numThreads, dest, pitch);
+
+    free(data);
+}
+
+void render_map_int(int *arr, int cols, int rows, int stride, int imgW, int imgH, int base, int range, unsigned char *colors, int pool, int numThreads, unsigned char *dest, long pitch)
+{
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_int;
+    data->pixels_per_cell = generate_pixels_per_cell_int;
+
+    heatmap_gen(data, imgW, imgH, colors, pool, numThreads, dest, pitch);
+
+    free(data);
+}
+
+void render_map_double(double *arr, int cols, int rows, int stride, int imgW, int imgH, double base, double range, unsigned char *colors, int pool, int numThreads, unsigned char *dest, long pitch)
+{
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_double;
+    data->pixels_per_cell = generate_pixels_per_cell_double;
+
+    heatmap_gen(data, imgW, imgH, colors, pool, numThreads, dest, pitch);
+
+    free(data);
+}
+
+void render_map_long(long *arr, int cols, int rows, int stride, int imgW, int imgH, long base, long range, unsigned char *colors, int pool, int numThreads, unsigned char *dest, long pitch)
+{
+    Matrix *data = init_matrix(arr, cols, rows, stride, base, range);
+    data->cells_per_pixel = generate_cells_per_pixel_long;
+    data->pixels_per_cell = generate_pixels_per_cell_long;
+
+    heatmap_gen(data, imgW, imgH, colors, pool, numThreads, dest, pitch);
+
+    free(data);
+}
+
+// Takes the same as generate_map_float, plus the BMP file name.
+// Maps the file and draws straight into its pixel array, so the image is never
+// held anywhere else or copied into place.
+// Returns 0 on success, 1 if the file could not be written.
+int generate_bmp_float(float *arr, int cols, int rows, int stride, int imgW, int imgH, float base, float range, unsigned char *colors, int pool, int numThreads, char *fileName)
+{
+    size_t mapSize;
+    unsigned char *file = bmp_map_image(imgH, imgW, fileName, &mapSize);
+    if (!file)
+        return 1;
+
+    // BMP rows run bottom-up, so the top image row is the last one in the file
+    long rowBytes = bmp_row_bytes(imgW);
+    unsigned char *topRow = file + BMP_HEADER_SIZE + (rowBytes * (imgH - 1));
+    render_map_float(arr, cols, rows, stride, imgW, imgH, base, range, colors, pool, numThreads, topRow, -rowBytes);
+
+    bmp_unmap_image(file, mapSize);
+    return 0;
+}
+
+// Takes the same as generate_map_float, plus the PNG file name,
+// and where to put the file's size.
+// Draws the heatmap, then compresses it into a PNG on every thread.
+// Returns 0 on success, 1 if the file could not be written.
+int generate_png_float(float *arr, int cols, int rows, int stride, int imgW, int imgH, float base, float range, unsigned char *colors, int pool, int numThreads, char *fileName, size_t *fileSize)
+{
+    unsigned char *heatmap = generate_map_float(arr, cols, rows, stride, imgW, imgH, base, range, colors, pool, numThreads);
+
+    int failed = png_write(heatmap, imgW, imgH, (long)imgW * BPP, numThreads, fileName, fileSize);
+
+    free(heatmap);
+    return failed;
+}
+
+// Takes a float matrix, its dimensions and stride, the smaller size to pool it to,
+// a POOL_* mode, thread count, and where to put the outW * outH packed result.
+// Values are pooled exactly as an image that size would color them, so e.g. halving
+// each side reduces every 2x2 block of cells (the last row and column may be 1 wide).
+void pool_map_float(float *arr, int cols, int rows, int stride, int outW, int outH, int pool, int numThreads, float *out)
+{
+    Matrix *data = init_matrix(arr, cols, rows, stride, 0, 1);
+
+    pool_cells_float(data, pool, out, outW, outH, numThreads);
+
+    free(data);
+}
+
 //
 /* Initializers for matrix and map structs, basically constructors. */
 //
-Matrix *init_matrix(void *matrix, int cols, int rows, long double base, long double range)
+Matrix *init_matrix(void *matrix, int cols, int rows, int stride, double base, double range)
 {
     Matrix *m = malloc(sizeof(*m));
 
     m->matrix  = matrix;
     m->cols    = cols;
     m->rows    = rows;
+    m->stride  = stride;
     m->baseVal = base;
     m->range   = range;
 
     return m;
 }
 
-Map *init_map(int width, int height, int bpp, unsigned char *colors)
+Map *init_map(int width, int height, int bpp, unsigned char *colors, int pool, int numThreads, unsigned char *dest, long pitch, double range)
 {
     Map *m = malloc(sizeof(*m));
 
-    m->map = malloc((width * height) * bpp * sizeof(*m->map));
+    if (dest)
+    {
+        m->map = dest;
+        m->pitch = pitch;
+    }
+    else
+    {
+        m->map = malloc((size_t)(width * height) * bpp * sizeof(*m->map));
+        m->pitch = (long)width * bpp;
+    }
     m->imgW = width;
     m->imgH = height;
+    m->threads = numThreads > 0 ? numThreads : 1;
+    m->pool = pool;
+
+    // -range lands on entry 0, +range on the last, the 0.5 rounds to the nearest entry
+    m->lutScale = ((LUT_SIZE - 1) / 2) / (float)range;
+    m->lutOffset = ((LUT_SIZE - 1) / 2) + 0.5f;
     m->bpp = bpp;
 
     Color temp;
@@ -154,217 +275,59 @@ Map *init_map(int width, int height, int bpp, unsigned char *colors)
     temp.r = colors[8];
     m->color_high = temp;
 
+    Color stops[] = {m->color_low, m->color_norm, m->color_high};
+    m->lut = malloc(LUT_SIZE * sizeof(Color));
+    build_lut(m->lut, LUT_SIZE, stops, 3);
+
     return m;
 }
 
 //
-/* The actual heavy lifting functions, converting the given data type matrix */
-/* into color data and storing it in unsigned char form.                     */
+/* Utility functions, basic operations used multiple times. */
 //
-// cells per pixel mode
-// Generates a 1d array containing pixel data for a heatmap
-// Takes matrix and dimension data to accomplish this
-// This one is for matrices larger than the image being generated
-void generate_cells_per_pixel(Matrix *data, Map *dataMap)
+// Takes an index, the span size, and how many spans get one extra.
+// Returns where span index starts, spans before it being size + 1 while the
+// extras last and size after. Any row's span is start(i) to start(i + 1), so
+// rows can be worked out on their own instead of walking down from the top.
+int heatmap_span(int index, int size, int extra)
 {
-    const int cells_per_color_x = data->cols / dataMap->imgW;
-    const int cells_per_color_y = data->rows / dataMap->imgH;
-
-    const int remainder_x = data->cols - (cells_per_color_x * dataMap->imgW);
-    const int remainder_y = data->rows - (cells_per_color_y * dataMap->imgH);
+    if (extra < 0)
+        extra = 0;
 
-    int ypos, yend, yrem;
-    ypos = yend = 0;
-    yrem = remainder_y;
-    for (int i = 0; i < dataMap->imgH; i++)
-    {
-        ypos = yend;
-        yend = ypos + cells_per_color_y;
-
-        if (yrem > 0)
-        {
-            yrem--;
-            yend++;
-        }
-
-        int xpos, xend, xrem;
-        xpos = xend = 0;
-        xrem = remainder_x;
-        for (int j = 0; j < dataMap->imgW; j++)
-        {
-            xpos = xend;
-            xend = xpos + cells_per_color_x;
-
-            if (xrem > 0)
-            {
-                xrem--;
-                xend++;
-            }
-            
-            Color chunk_p = avg_cell_chunk(data, dataMap, xpos, xend, ypos, yend);
-            int start_index = (j + (i * dataMap->imgW)) * dataMap->bpp;
-            dataMap->map[start_index + 0] = chunk_p.b;
-            dataMap->map[start_index + 1] = chunk_p.g;
-            dataMap->map[start_index + 2] = chunk_p.r;
-        }
-    }
+    return (index * size) + (index < extra ? index : extra);
 }
 
-// pixels per cell mode
-// Generates a 1d array containing color data for a heatmap
-// Takes matrix and dimension data to accomplish this
-// This one is for matrices smaller than the image being generated
-void generate_pixels_per_cell(Matrix *data, Map *dataMap)
+// Takes the table, its size, and color stops spread evenly from -range to +range.
+// Fills the table by lerping between the two stops around each entry, any number
+// of stops works, 3 (low, norm, high) is the regular heatmap.
+void build_lut(Color *lut, int size, Color *stops, int numStops)
 {
-    // x/y chunks per pixel, and remainder chunks after those
-    const int colors_per_cell_x = 1. / ((float)data->cols / (float)dataMap->imgW);
-    const int colors_per_cell_y = 1. / ((float)data->rows / (float)dataMap->imgH);
-
-    const int remainder_x = dataMap->imgW - (colors_per_cell_x * data->cols);
-    const int remainder_y = dataMap->imgH - (colors_per_cell_y * data->rows);
+    int segments = numStops - 1;
 
-    int ypos, yend, yrem;
-    ypos = yend = 0;
-    yrem = remainder_y;
-    for (int i = 0; i < data->rows; i++)
+    for (int i = 0; i < size; i++)
     {
-        ypos = yend;
-        yend = ypos + colors_per_cell_y;
-
-        if (yrem > 0)
-        {
-            yrem--;
-            yend++;
-        }
-
-        int xpos, xend, xrem;
-        xpos = xend = 0;
-        xrem = remainder_x;
-        for (int j = 0; j < data->cols; j++)
-        {
-            xpos = xend;
-            xend = xpos + colors_per_cell_x;
-
-            if (xrem > 0)
-            {
-                xrem--;
-                xend++;
-            }
-
-            // Fills multiple pixels in map, easiest way to handle this method
-            fill_pixels(dataMap, data, j + (i * data->cols), xpos, xend, ypos, yend);
-        }
-    }
-}
-
-// Fills in multiple pixels in the output array,
-// equal to a "chunk" of matrix cells, of a given size.
-// Math to figure out chunk size is done elsewhere and fed in.
-void fill_pixels(Map *dataMap, Matrix *data, int cell_index, int start_x, int end_x, int start_y, int end_y)
-{
-    long double relativeTemp = data->get_relative_val(data, cell_index);
+        float pos = (float)i * segments / (size - 1); // 0 to segments
+        int s = (int)pos;
+        if (s >= segments)
+            s = segments - 1;
 
-    Color c;
-    if (relativeTemp >= 0)
-    {
-        float t = relativeTemp / data->range;
-        if (t > 1.0)
-            t = 1.0;
-        
-        c = lerp(dataMap->color_norm, dataMap->color_high, t);
-    }
-    else if (relativeTemp < 0)
-    {
-        float t = -relativeTemp / data->range;
-        if (t > 1.0)
-            t = 1.0;
-        
-        c = lerp(dataMap->color_norm, dataMap->color_low, t);
-    }
-
-    for (int i = start_y; i < end_y; i++)
-    {
-        for (int j = start_x; j < end_x; j++)
-        {
-            int start_index = (j + (i * dataMap->imgW)) * dataMap->bpp;
-            dataMap->map[start_index + 0] = c.b;
-            dataMap->map[start_index + 1] = c.g;
-            dataMap->map[start_index + 2] = c.r;
-        }
+        lut[i] = lerp(stops[s], stops[s + 1], pos - s);
     }
 }
 
-// Averages a "chunk" of cells in the matrix,
-// of a given size. This forms an averaged heat
-// pixel in the final image.
-// Math done elsewhere for chunk size, and fed in.
-Color avg_cell_chunk(Matrix *data, Map *dataMap, int start_x, int end_x, int start_y, int end_y)
+// Takes the map and a cell's value relative to the base.
+// Returns its color, the table entry nearest to it, anything past +-range clamped to the ends.
+Color lut_color(Map *dataMap, float relativeTemp)
 {
-    int redAvg = 0, greenAvg = 0, blueAvg = 0;
-    Color c;
-
-    for (int i = start_y; i < end_y; i++)
-    {
-        for (int j = start_x; j < end_x; j++)
-        {
-            float relativeTemp = data->get_relative_val(data, j + (i * data->cols));
-
-            if (relativeTemp >= 0)
-            {
-                float t = relativeTemp / data->range;
-                if (t > 1.0)
-                    t = 1.0;
-
-                c = lerp(dataMap->color_norm, dataMap->color_high, t);
-            }
-            else if (relativeTemp < 0)
-            {
-                float t = -relativeTemp / data->range;
-                if (t > 1.0)
-                    t = 1.0;
-                
-                c = lerp(dataMap->color_norm, dataMap->color_low, t);
-            }
-
-            redAvg   += c.r;
-            greenAvg += c.g;
-            blueAvg  += c.b;
-        }
-    }
-
-    int total = (end_x - start_x) * (end_y - start_y);
-
-    blueAvg  /= total;
-    greenAvg /= total;
-    redAvg   /= total;
-
-    blueAvg  = bind(blueAvg, 0, 255);
-    greenAvg = bind(greenAvg, 0, 255);
-    redAvg   = bind(redAvg, 0, 255);
+    float index = (relativeTemp * dataMap->lutScale) + dataMap->lutOffset;
 
-    Color chunk_p;
-    chunk_p.b = blueAvg;
-    chunk_p.g = greenAvg;
-    chunk_p.r = redAvg;
+    // written so NaN ends up at the middle entry rather than out of bounds
+    if (!(index >= 0))
+        index = index < 0 ? 0 : dataMap->lutOffset;
+    else if (index > LUT_SIZE - 1)
+        index = LUT_SIZE - 1;
 
-    return chunk_p;
-}
-
-//
-/* Utility functions, basic operations used multiple times. */
-//
-int bind(int val, int min, int max)
-{
-    if (val < 0)
-    {
-        val = 0;
-    }
-    else if (val > 255)
-    {
-        val = 255;
-    }
-    
-    return val;
+    return dataMap->lut[(int)index];
 }
 
 Color lerp(Color c1, Color c2, float t)
@@ -374,32 +337,4 @@ Color lerp(Color c1, Color c2, float t)
     newColor.g = c1.g * (1.0 - t) + (c2.g * t);
     newColor.r = c1.r * (1.0 - t) + (c2.r * t);
     return newColor;
-}
-
-//
-/* Type-specific functions for use as function pointers,          */
-/* these are used in structs to specify how to handle the matrix. */
-//
-long double relative_val_float(Matrix *m, const int i)
-{
-    float val = ((float *)m->matrix)[i];
-    return (long double)(val - m->baseVal);
-}
-
-long double relative_val_int(Matrix *m, const int i)
-{
-    int val = ((int *)m->matrix)[i];
-    return (long double)(val - m->baseVal);
-}
-
-long double relative_val_double(Matrix *m, const int i)
-{
-    double val = ((double *)m->matrix)[i];
-    return (long double)(val - m->baseVal);
-}
-
-long double relative_val_long(Matrix *m, const int i)
-{
-    long val = ((double *)m->matrix)[i];
-    return (long double)(val - m->baseVal);
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef HEATMAP_H
 #define HEATMAP_H
 
+#include <stddef.h>
+
 #define BPP 3
                                 // best results:
 #define B_DEFAULT 10            // 10
@@ -12,6 +14,13 @@
 #define BLUE_SHIFT -5           // -4
 #define GREEN_SHIFT 2           // 2
 
+// how a chunk of cells becomes one pixel, when the image is smaller than the matrix
+#define POOL_MEAN 0             // average value, the default
+#define POOL_MAX 1              // hottest cell, keeps small hotspots visible
+#define POOL_MIN 2              // coldest cell
+
+#define LUT_SIZE 4097           // colors baked per map, odd so a relative value of 0 is the middle entry
+
 typedef struct Color
 {
     unsigned char b;
@@ -20,32 +29,61 @@ typedef struct Color
 } Color;
 
 typedef struct Matrix Matrix;
+typedef struct Map Map;
 
 typedef struct Matrix
 {
     void *matrix;
     int cols;
     int rows;
-    long double baseVal; // base value of matrix, the "room temperature"
-    long double range;   // the deviance value that will result in a 0.0 or 1.0 lerp
-    long double (*get_relative_val)(Matrix *, const int); // gets relative value between two vars, func ptr
+    int stride;          // elements from the start of one row to the next, >= cols
+    double baseVal;      // base value of matrix, the "room temperature"
+    double range;        // the deviance value that will result in a 0.0 or 1.0 lerp
+
+    // kernels for the matrix's element type, from heatmap_kernel.h, one call per image
+    void (*cells_per_pixel)(Matrix *, Map *);
+    void (*pixels_per_cell)(Matrix *, Map *);
 
 } Matrix;
 
 typedef struct Map
 {
-    unsigned char *map;
+    unsigned char *map;  // first pixel of the top image row
     int imgW;
     int imgH;
     int bpp;
+    int threads;         // threads the rows are split across
+    int pool;            // POOL_* mode
+    long pitch;          // bytes from one image row to the one below it, negative when stored bottom-up
     Color color_low;
     Color color_norm;
     Color color_high;
+    Color *lut;          // LUT_SIZE colors for relative values -range to +range
+    float lutScale;      // relative value * lutScale + lutOffset is the entry, before clamping
+    float lutOffset;
 } Map;
 
-unsigned char *generate_map_float(float *, int, int, int, int, float, float, unsigned char *);
-unsigned char *generate_map_int(int *, int, int, int, int, int, int, unsigned char *);
-unsigned char *generate_map_double(double *, int, int, int, int, double, double, unsigned char *);
-unsigned char *generate_map_long(long *, int, int, int, int, long, long, unsigned char *);
+unsigned char *generate_map_float(float *, int, int, int, int, int, float, float, unsigned char *, int, int);
+unsigned char *generate_map_int(int *, int, int, int, int, int, int, int, unsigned char *, int, int);
+unsigned char *generate_map_double(double *, int, int, int, int, int, double, double, unsigned char *, int, int);
+unsigned char *generate_map_long(long *, int, int, int, int, int, long, long, unsigned char *, int, int);
+
+void render_map_float(float *, int, int, int, int, int, float, float, unsigned char *, int, int, unsigned char *, long);
+void render_map_int(int *, int, int, int, int, int, int, int, unsigned char *, int, int, unsigned char *, long);
+void render_map_double(double *, int, int, int, int, int, double, double, unsigned char *, int, int, unsigned char *, long);
+void render_map_long(long *, int, int, int, int, int, long, long, unsigned char *, int, int, unsigned char *, long);
+
+int generate_bmp_float(float *, int, int, int, int, int, float, float, unsigned char *, int, int, char *);
+int generate_png_float(float *, int, int, int, int, int, float, float, unsigned char *, int, int, char *, size_t *);
+
+void pool_map_float(float *, int, int, int, int, int, int, int, float *);
+int heatmap_span(int, int, int);
+
+// picks the generate_map_* for the array's type, generate_map(arr, cols, rows, ...)
+#define generate_map(arr, ...) _Generic((arr),      \
+    float *: generate_map_float,                    \
+    int *: generate_map_int,                        \
+    double *: generate_map_double,                  \
+    long *: generate_map_long)(arr, __VA_ARGS__)
 
 #endif
\ No newline at end of file
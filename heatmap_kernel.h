@@ -0,0 +1,227 @@
+// Render kernels for one matrix element type, included by heatmap.c once per type.
+// No include guard on purpose, each include stamps out another copy of the kernels.
+//
+// Before including, define:
+//   HEATMAP_TYPE  the element type, float, int, ...
+//   HEATMAP_DIFF  the type cell - base is worked out in, wide enough to not overflow
+//   HEATMAP_NAME  suffix for the function names
+//
+// Every cell is read straight out of a HEATMAP_TYPE array and its color is a LUT load,
+// so the per-cell path has no function pointer and no long double.
+
+#define HEATMAP_CAT_(a, b) a##_##b
+#define HEATMAP_CAT(a, b) HEATMAP_CAT_(a, b)
+#define HEATMAP_FN(name) HEATMAP_CAT(name, HEATMAP_NAME)
+
+// Reduces a "chunk" of cells in the matrix to the one value
+// its pixel gets colored by. pool (POOL_*) picks the mean, max, or min of the chunk.
+// Each row segment is reduced in one simd loop, then the rows are combined,
+// so colors are looked up once per pixel instead of once per cell.
+double HEATMAP_FN(pool_cell_chunk)(Matrix *data, int pool, int start_x, int end_x, int start_y, int end_y)
+{
+    const HEATMAP_TYPE *arr = (const HEATMAP_TYPE *)data->matrix;
+    const int len = end_x - start_x;
+
+    if (pool == POOL_MEAN)
+    {
+        double total = 0; // segments are summed in HEATMAP_DIFF, the whole chunk in double
+
+        for (int i = start_y; i < end_y; i++)
+        {
+            const HEATMAP_TYPE *seg = &arr[((size_t)i * data->stride) + start_x];
+            HEATMAP_DIFF sum = 0;
+
+            #pragma omp simd reduction(+:sum)
+            for (int j = 0; j < len; j++)
+            {
+                sum += seg[j];
+            }
+            total += sum;
+        }
+
+        return total / ((double)len * (end_y - start_y));
+    }
+
+    HEATMAP_TYPE best = arr[((size_t)start_y * data->stride) + start_x];
+
+    for (int i = start_y; i < end_y; i++)
+    {
+        const HEATMAP_TYPE *seg = &arr[((size_t)i * data->stride) + start_x];
+
+        if (pool == POOL_MAX)
+        {
+            #pragma omp simd reduction(max:best)
+            for (int j = 0; j < len; j++)
+            {
+                best = seg[j] > best ? seg[j] : best;
+            }
+        }
+        else
+        {
+            #pragma omp simd reduction(min:best)
+            for (int j = 0; j < len; j++)
+            {
+                best = seg[j] < best ? seg[j] : best;
+            }
+        }
+    }
+
+    return best;
+}
+
+// cells per pixel mode
+// Generates a 1d array containing pixel data for a heatmap
+// Takes matrix and dimension data to accomplish this
+// This one is for matrices larger than the image being generated
+// Image rows are split across threads, each works out its own rows' cells with heatmap_span
+void HEATMAP_FN(generate_cells_per_pixel)(Matrix *data, Map *dataMap)
+{
+    const int cells_per_color_x = data->cols / dataMap->imgW;
+    const int cells_per_color_y = data->rows / dataMap->imgH;
+
+    const int remainder_x = data->cols - (cells_per_color_x * dataMap->imgW);
+    const int remainder_y = data->rows - (cells_per_color_y * dataMap->imgH);
+
+    const HEATMAP_TYPE *arr = (const HEATMAP_TYPE *)data->matrix;
+    const HEATMAP_DIFF base = (HEATMAP_DIFF)data->baseVal;
+    const int one_to_one = cells_per_color_x == 1 && cells_per_color_y == 1 && !remainder_x && !remainder_y;
+
+    #pragma omp parallel for num_threads(dataMap->threads) schedule(static)
+    for (int i = 0; i < dataMap->imgH; i++)
+    {
+        int ypos = heatmap_span(i, cells_per_color_y, remainder_y);
+        int yend = heatmap_span(i + 1, cells_per_color_y, remainder_y);
+
+        if (one_to_one)
+        {
+            // one cell per pixel, nothing to pool
+            const HEATMAP_TYPE *row = &arr[(size_t)i * data->stride];
+            unsigned char *out = &dataMap->map[i * dataMap->pitch];
+            for (int j = 0; j < dataMap->imgW; j++)
+            {
+                Color c = lut_color(dataMap, (float)((HEATMAP_DIFF)row[j] - base));
+                out[(j * dataMap->bpp) + 0] = c.b;
+                out[(j * dataMap->bpp) + 1] = c.g;
+                out[(j * dataMap->bpp) + 2] = c.r;
+            }
+            continue;
+        }
+
+        int xpos, xend, xrem;
+        xpos = xend = 0;
+        xrem = remainder_x;
+        for (int j = 0; j < dataMap->imgW; j++)
+        {
+            xpos = xend;
+            xend = xpos + cells_per_color_x;
+
+            if (xrem > 0)
+            {
+                xrem--;
+                xend++;
+            }
+
+            double v = HEATMAP_FN(pool_cell_chunk)(data, dataMap->pool, xpos, xend, ypos, yend);
+            Color chunk_p = lut_color(dataMap, (float)(v - data->baseVal));
+            long start_index = (i * dataMap->pitch) + (j * dataMap->bpp);
+            dataMap->map[start_index + 0] = chunk_p.b;
+            dataMap->map[start_index + 1] = chunk_p.g;
+            dataMap->map[start_index + 2] = chunk_p.r;
+        }
+    }
+}
+
+// Pools the matrix down to an outW x outH grid of floats, packed, cut into the same
+// chunks generate_cells_per_pixel colors. Lets a smaller grid be built once from a
+// bigger one instead of re-reading the big one. outW and outH must fit in the matrix.
+void HEATMAP_FN(pool_cells)(Matrix *data, int pool, float *out, int outW, int outH, int numThreads)
+{
+    const int cells_x = data->cols / outW;
+    const int cells_y = data->rows / outH;
+
+    const int remainder_x = data->cols - (cells_x * outW);
+    const int remainder_y = data->rows - (cells_y * outH);
+
+    #pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int i = 0; i < outH; i++)
+    {
+        int ypos = heatmap_span(i, cells_y, remainder_y);
+        int yend = heatmap_span(i + 1, cells_y, remainder_y);
+
+        for (int j = 0; j < outW; j++)
+        {
+            int xpos = heatmap_span(j, cells_x, remainder_x);
+            int xend = heatmap_span(j + 1, cells_x, remainder_x);
+
+            out[((size_t)i * outW) + j] = (float)HEATMAP_FN(pool_cell_chunk)(data, pool, xpos, xend, ypos, yend);
+        }
+    }
+}
+
+// pixels per cell mode
+// Generates a 1d array containing color data for a heatmap
+// Takes matrix and dimension data to accomplish this
+// This one is for matrices smaller than the image being generated
+// Matrix rows are split across threads, each finds its image rows with heatmap_span,
+// draws the first, then copies it down the rest of the span.
+void HEATMAP_FN(generate_pixels_per_cell)(Matrix *data, Map *dataMap)
+{
+    const HEATMAP_TYPE *arr = (const HEATMAP_TYPE *)data->matrix;
+    const HEATMAP_DIFF base = (HEATMAP_DIFF)data->baseVal;
+
+    // x/y chunks per pixel, and remainder chunks after those
+    const int colors_per_cell_x = 1. / ((float)data->cols / (float)dataMap->imgW);
+    const int colors_per_cell_y = 1. / ((float)data->rows / (float)dataMap->imgH);
+
+    const int remainder_x = dataMap->imgW - (colors_per_cell_x * data->cols);
+    const int remainder_y = dataMap->imgH - (colors_per_cell_y * data->rows);
+
+    const size_t rowBytes = (size_t)dataMap->imgW * dataMap->bpp;
+
+    #pragma omp parallel for num_threads(dataMap->threads) schedule(static)
+    for (int i = 0; i < data->rows; i++)
+    {
+        int ypos = heatmap_span(i, colors_per_cell_y, remainder_y);
+        int yend = heatmap_span(i + 1, colors_per_cell_y, remainder_y);
+        if (ypos >= yend)
+            continue; // rows past the bottom of the image
+
+        unsigned char *first = &dataMap->map[ypos * dataMap->pitch];
+        const HEATMAP_TYPE *row = &arr[(size_t)i * data->stride];
+
+        int xpos, xend, xrem;
+        xpos = xend = 0;
+        xrem = remainder_x;
+        for (int j = 0; j < data->cols; j++)
+        {
+            xpos = xend;
+            xend = xpos + colors_per_cell_x;
+
+            if (xrem > 0)
+            {
+                xrem--;
+                xend++;
+            }
+
+            // Fills multiple pixels in the row, one color for the whole chunk
+            Color c = lut_color(dataMap, (float)((HEATMAP_DIFF)row[j] - base));
+
+            for (int x = xpos; x < xend; x++)
+            {
+                first[(x * dataMap->bpp) + 0] = c.b;
+                first[(x * dataMap->bpp) + 1] = c.g;
+                first[(x * dataMap->bpp) + 2] = c.r;
+            }
+        }
+
+        for (int y = ypos + 1; y < yend; y++)
+            memcpy(&dataMap->map[y * dataMap->pitch], first, rowBytes);
+    }
+}
+
+#undef HEATMAP_FN
+#undef HEATMAP_CAT
+#undef HEATMAP_CAT_
+#undef HEATMAP_TYPE
+#undef HEATMAP_DIFF
+#undef HEATMAP_NAME
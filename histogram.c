@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "histogram.h"
+
+#define HIST_BITS_MIN ((127 + HIST_EXP_MIN) * HIST_STEPS) // float bits >> 16 of 2^HIST_EXP_MIN
+
+int histogram_bin(struct Histogram *, float);
+float histogram_edge(int);
+
+// Takes the histogram, and the base temperature deviations are measured from.
+void histogram_init(struct Histogram *hist, float base)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->base = base;
+}
+
+// Takes the histogram, a thread's own HIST_BINS counts, and a run of values.
+// Counts the values into the thread's counts, merge them in with histogram_merge.
+// Meant to be called on a row right after it is computed, while it is still in cache.
+void histogram_count(struct Histogram *hist, long *counts, float *values, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        counts[histogram_bin(hist, values[i])]++;
+    }
+}
+
+// Takes the histogram and one thread's counts, adds them in.
+// Call from one thread at a time.
+void histogram_merge(struct Histogram *hist, long *counts)
+{
+    for (int b = 0; b < HIST_BINS; b++)
+    {
+        hist->counts[b] += counts[b];
+        hist->total += counts[b];
+    }
+}
+
+// Takes the histogram, matrix, dimensions, stride, and thread count.
+// Counts the whole matrix in its own parallel pass, for when it could not be
+// counted during the last timestep.
+void histogram_fill(struct Histogram *hist, float *matrix, int cols, int rows, int stride, int numThreads)
+{
+    #pragma omp parallel num_threads(numThreads)
+    {
+        long *counts = (long *)calloc(HIST_BINS, sizeof(long));
+
+        #pragma omp for schedule(static)
+        for (int i = 0; i < rows; i++)
+        {
+            histogram_count(hist, counts, &matrix[(size_t)i * stride], cols);
+        }
+
+        #pragma omp critical
+        histogram_merge(hist, counts);
+
+        free(counts);
+    }
+}
+
+// Takes the histogram and a percentile, 0 to 100.
+// Returns the deviation from base at or below which that share of the cells lie, taken
+// at the bin's edge furthest from base, so ranges built from it never clip those cells.
+float histogram_percentile(struct Histogram *hist, float percentile)
+{
+    long target = (long)((percentile / 100.0) * hist->total);
+    long seen = 0;
+    int bin = 0;
+
+    for (; bin < HIST_BINS - 1; bin++)
+    {
+        seen += hist->counts[bin];
+        if (seen > target)
+            break;
+    }
+
+    if (bin < HIST_SIDE)
+        return -histogram_edge(HIST_SIDE - 1 - bin);
+    return histogram_edge(bin - HIST_SIDE);
+}
+
+// Takes the histogram, and the low and high percentiles.
+// Returns the color range, how far from base the further of the two percentiles is.
+float histogram_range(struct Histogram *hist, float lowPercentile, float highPercentile)
+{
+    float below = -histogram_percentile(hist, lowPercentile);
+    float above = histogram_percentile(hist, highPercentile);
+
+    return below > above ? below : above;
+}
+
+// Takes the histogram and a value, returns its bin.
+// The top bits of a positive float are its power of two then the leading bits of the
+// mantissa, so they count up evenly in log space with no call to log.
+int histogram_bin(struct Histogram *hist, float value)
+{
+    float dev = value - hist->base;
+    float mag = fabsf(dev);
+    uint32_t bits;
+    memcpy(&bits, &mag, sizeof(bits));
+
+    int step = (int)(bits >> 16) - HIST_BITS_MIN;
+    step = step < 0 ? 0 : (step >= HIST_SIDE ? HIST_SIDE - 1 : step);
+
+    return dev < 0 ? HIST_SIDE - 1 - step : HIST_SIDE + step;
+}
+
+// Takes a step on one side of base, returns the distance from base of its outer edge.
+float histogram_edge(int step)
+{
+    uint32_t bits = (uint32_t)(step + 1 + HIST_BITS_MIN) << 16;
+    float mag;
+    memcpy(&mag, &bits, sizeof(mag));
+
+    return mag;
+}
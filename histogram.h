@@ -0,0 +1,28 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// Cells are binned by how far they are from base, on a log scale so no bounds are needed
+// up front: each power of two gets HIST_STEPS bins, between 2^HIST_EXP_MIN and 2^HIST_EXP_MAX
+// degrees either side. Smaller deviations share the first bin, bigger ones the last.
+#define HIST_STEPS 128   // bins per power of two, each is under 1% wide
+#define HIST_EXP_MIN -10
+#define HIST_EXP_MAX 22
+#define HIST_SIDE (HIST_STEPS * (HIST_EXP_MAX - HIST_EXP_MIN)) // bins below base, and again above
+#define HIST_BINS (HIST_SIDE * 2)
+
+// Counts of matrix values, for picking the image color range from percentiles.
+struct Histogram
+{
+    float base;
+    long counts[HIST_BINS]; // coldest first
+    long total;
+};
+
+void histogram_init(struct Histogram *, float);
+void histogram_count(struct Histogram *, long *, float *, int);
+void histogram_merge(struct Histogram *, long *);
+void histogram_fill(struct Histogram *, float *, int, int, int, int);
+float histogram_percentile(struct Histogram *, float);
+float histogram_range(struct Histogram *, float, float);
+
+#endif
@@ -1,14 +1,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <omp.h>
 #include "matrix.h"
+#include "stencil.h"
 #include <math.h>
 
-#define WRITE_BUFF_MULT 8
-#define CONV_BUFF_SIZE 64
+#define CONV_BUFF_SIZE 64            // longest text one cell can turn into, "%.9f" of FLT_MAX included
+#define WRITE_CHUNK_BYTES (4 << 20)  // worst case text each thread formats before writing it out
+#define TILE_DIM 128 // edge of a fused tile's core, both scratch copies fit around L2 size
 
-float matrix_sum_neighbors(float *, int, int, int, int, float);
+float matrix_edge_cell(float *, int, int, int, int, float, float);
+void matrix_edge_update(float *, float *, int, int, int, int, float, float, float *, double *);
 
 // Takes row/col sizes, allocates an EMPTY matrix accordingly.
 // Returns matrix ptr
@@ -38,6 +44,97 @@ float *matrix_init(int cols, int rows, float base)
     return matrix_ptr;
 }
 
+// Takes column count, returns the row stride (in floats) of a padded matrix.
+// Room for the left padding, the row, and a ghost cell after it, rounded up
+// so every row is a whole number of cache lines.
+int matrix_padded_stride(int cols)
+{
+    int stride = MATRIX_PAD + cols + 1;
+    return ((stride + MATRIX_PAD - 1) / MATRIX_PAD) * MATRIX_PAD;
+}
+
+// Takes row/col sizes and the base temp, and allocates a padded matrix.
+// The returned pointer is cell 0,0, a ghost row sits above row 0 and below the
+// last row, and each row has a ghost cell on both ends. Every ghost cell holds
+// base permanently, so the edges need no special casing when stepping.
+// Rows are matrix_padded_stride(cols) floats apart and start on a cache line.
+// Returns matrix ptr, which must be freed with matrix_free.
+float *matrix_init_padded(int cols, int rows, float base)
+{
+    int stride = matrix_padded_stride(cols);
+    size_t total = (size_t)stride * (rows + 2);
+
+    float *block = (float *)aligned_alloc(MATRIX_ALIGN, total * sizeof(float));
+    if (!block)
+        return NULL;
+
+    for (size_t i = 0; i < total; i++)
+    {
+        block[i] = base;
+    }
+
+    // skip the top ghost row and the left padding,
+    // which leaves the left ghost cell just before the aligned row start
+    return block + stride + MATRIX_PAD;
+}
+
+// Takes a matrix and its dimensions, frees it whether it came from
+// matrix_init/matrix_init_empty (stride == cols) or matrix_init_padded.
+void matrix_free(float *matrix, int cols, int stride)
+{
+    if (!matrix)
+        return;
+
+    if (stride == cols)
+        free(matrix);
+    else
+        free(matrix - stride - MATRIX_PAD);
+}
+
+// Takes row/col sizes, the base temp, and a STORAGE_* format (F16 or BF16).
+// Same layout as matrix_init_padded, ghost cells and all, but every cell is a
+// 16 bit float, so the matrix takes half the memory and half the bandwidth.
+// Returns matrix ptr, which must be freed with matrix_free_half.
+uint16_t *matrix_init_half(int cols, int rows, float base, int format)
+{
+    int stride = matrix_padded_stride(cols);
+    size_t total = (size_t)stride * (rows + 2);
+    size_t bytes = ((total * sizeof(uint16_t) + MATRIX_ALIGN - 1) / MATRIX_ALIGN) * MATRIX_ALIGN;
+
+    uint16_t *block = (uint16_t *)aligned_alloc(MATRIX_ALIGN, bytes);
+    if (!block)
+        return NULL;
+
+    uint16_t fill = half_from_float_one(base, format);
+    for (size_t i = 0; i < total; i++)
+    {
+        block[i] = fill;
+    }
+
+    return block + stride + MATRIX_PAD;
+}
+
+// Takes a matrix from matrix_init_half and its stride, and frees it.
+void matrix_free_half(uint16_t *matrix, int stride)
+{
+    if (matrix)
+        free(matrix - stride - MATRIX_PAD);
+}
+
+// Takes a padded float matrix to fill, a matrix from matrix_init_half, dimensions,
+// their shared stride, STORAGE_* format and thread count.
+// Widens every cell into the float matrix, for the outputs, which only take floats.
+void matrix_from_half(float *dest, uint16_t *src, int cols, int rows, int stride, int format, int numThreads)
+{
+    half_init();
+
+    #pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int i = 0; i < rows; i++)
+    {
+        half_to_float(&dest[(size_t)i * stride], &src[(size_t)i * stride], cols, format);
+    }
+}
+
 // out of date, slow, not needed
 // Takes row/col sizes and the base temp, and allocates a matrix accordingly.
 // This version runs in parallel with given number of threads.
@@ -59,56 +156,180 @@ float *matrix_init(int cols, int rows, float base)
     return matrix_ptr;
 }*/
 
-// Takes 2d array matrix, its dimensions, and an output file name.
-// Prints a buffer containing every cell of the matrix to the given file.
-// Done this way to avoid literally 25 million fprintf's, because thats slow.
-void matrix_out(float *matrix, int cols, int rows, char *outFileName)
+// Takes 2d array matrix, its dimensions and row stride, digits after the decimal point,
+// thread count, and an output file name.
+// Writes every cell as text ("%.1f," for a precision of 1), one matrix row per line.
+// Threads each format a chunk of rows into their own buffer, then write it at its
+// place in the file with pwrite, so chunks land in order without any thread waiting
+// on another's formatting. Memory use is bounded by WRITE_CHUNK_BYTES per thread,
+// no matter how big the matrix is.
+void matrix_out(float *matrix, int cols, int rows, int stride, int precision, int numThreads, char *outFileName)
 {
-    int writeBuffSize = (cols * rows) * (sizeof(char) * WRITE_BUFF_MULT);
-    char *write_buffer = (char *)malloc(writeBuffSize);
-    write_buffer[0] = '\0';
-    char convert_buffer[CONV_BUFF_SIZE];
-    int strSize = 0;
+    int outFile = open(outFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-    FILE *outFile;
-    outFile = fopen(outFileName, "w"); // w for write only
-
-    if (!outFile) // !outFile = file could not be opened, is NULL
+    if (outFile < 0) // file could not be opened
     {
         printf("ERROR: Output file could not be opened.\n");
         return;
     }
 
-    for (int i = 0; i < rows; i++)
+    // rows per chunk, sized for the worst case text so buffers can never overflow
+    size_t rowMax = ((size_t)cols * CONV_BUFF_SIZE) + 1;
+    int chunkRows = WRITE_CHUNK_BYTES / rowMax;
+    if (chunkRows < 1)
+        chunkRows = 1;
+
+    int numChunks = (rows + chunkRows - 1) / chunkRows;
+    size_t *chunkLen = (size_t *)malloc(numThreads * sizeof(size_t));
+    off_t fileLen = 0;
+    int failed = 0;
+
+    #pragma omp parallel num_threads(numThreads)
     {
-        for (int j = 0; j < cols; j++)
+        int thread = omp_get_thread_num();
+        int team = omp_get_num_threads();
+        char *buffer = (char *)malloc(rowMax * chunkRows);
+
+        // one round formats "team" chunks side by side, then writes them
+        for (int round = 0; round < numChunks; round += team)
         {
-            // Converts float to string and stores it in a 64 byte buffer
-            snprintf(convert_buffer, sizeof(convert_buffer), "%.1f,", matrix[j + (i * cols)]);
-            // Concatonates to main buffer by null terminator
-            int numLen = strlen(convert_buffer);
-            for (int k = 0; k < numLen; k++)
+            int chunk = round + thread;
+            size_t len = 0;
+
+            if (chunk < numChunks)
             {
-                write_buffer[k + strSize] = convert_buffer[k];
+                int rowEnd = (chunk + 1) * chunkRows < rows ? (chunk + 1) * chunkRows : rows;
+                for (int i = chunk * chunkRows; i < rowEnd; i++)
+                {
+                    for (int j = 0; j < cols; j++)
+                    {
+                        len += matrix_format_cell(&buffer[len], matrix[j + ((size_t)i * stride)], precision);
+                        buffer[len++] = ',';
+                    }
+                    buffer[len++] = '\n';
+                }
             }
-            write_buffer[numLen + strSize] = '\0';
-            strSize += numLen;
-        }
+            chunkLen[thread] = len;
 
-        // Checks if buffer is 80% full, and writes/empties if so
-        if (strSize > (writeBuffSize * 0.8))
-        {
-            fprintf(outFile, "%s", write_buffer);
-            write_buffer[0] = '\0';
-            strSize = 0;
+            #pragma omp barrier
+
+            // every thread adds up the chunks before its own to find where it goes
+            off_t offset = fileLen;
+            for (int t = 0; t < thread; t++)
+            {
+                offset += chunkLen[t];
+            }
+
+            for (size_t done = 0; done < len;)
+            {
+                ssize_t written = pwrite(outFile, &buffer[done], len - done, offset + done);
+                if (written <= 0)
+                {
+                    failed = 1;
+                    break;
+                }
+                done += written;
+            }
+
+            // everyone has read chunkLen before it is reused
+            #pragma omp barrier
+
+            #pragma omp single
+            {
+                for (int t = 0; t < team; t++)
+                {
+                    fileLen += chunkLen[t];
+                }
+
+                // the first round gives a good guess of the final size,
+                // reserving it now saves the file system growing it bit by bit
+                if (round == 0 && numChunks > team)
+                    posix_fallocate(outFile, fileLen, (fileLen / (team * chunkRows)) * (rows - (team * chunkRows)));
+            }
         }
-        write_buffer[strSize] = '\n';
-        strSize++;
+
+        free(buffer);
     }
-    // ONE write to file, because we are going for speed here
-    fprintf(outFile, "%s", write_buffer);
 
-    free(write_buffer);
+    // the reservation may have overshot
+    if (ftruncate(outFile, fileLen) || failed)
+        printf("ERROR: Output file could not be written.\n");
+
+    close(outFile);
+    free(chunkLen);
+}
+
+// Takes an output buffer (at least CONV_BUFF_SIZE long), a value, and digits after
+// the decimal point (0-9).
+// Writes the value exactly as snprintf's "%.<precision>f" would, without the terminator.
+// A float is m * 2^e with a 24 bit m, so value * 10^precision is an exact integer
+// ratio that fits 64 bits, and rounding it (half to even, like printf) is exact too.
+// Values too big for that, and infinities/NaNs, fall back to snprintf.
+// Returns the number of characters written.
+int matrix_format_cell(char *out, float value, int precision)
+{
+    static const uint64_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                                      10000000, 100000000, 1000000000};
+
+    int exponent;
+    float fraction = frexpf(fabsf(value), &exponent); // |value| = fraction * 2^exponent, fraction in [0.5, 1)
+
+    if (!isfinite(value) || exponent > 30)
+        return snprintf(out, CONV_BUFF_SIZE, "%.*f", precision, value);
+
+    uint64_t mantissa = (uint64_t)ldexpf(fraction, 24); // |value| = mantissa * 2^(exponent - 24)
+    int shift = 24 - exponent;
+    uint64_t scaled;
+
+    if (shift <= 0)
+    {
+        // whole number, mantissa * 2^-shift * 10^precision stays under 2^(24 + 6 + 30)
+        scaled = (mantissa << -shift) * powers[precision];
+    }
+    else if (shift >= 64)
+    {
+        scaled = 0; // under 2^-40, rounds to 0 at any precision
+    }
+    else
+    {
+        uint64_t product = mantissa * powers[precision];
+        uint64_t remainder = product & ((((uint64_t)1) << shift) - 1);
+        uint64_t half = ((uint64_t)1) << (shift - 1);
+        scaled = product >> shift;
+
+        if (remainder > half || (remainder == half && (scaled & 1)))
+            scaled++;
+    }
+
+    int len = 0;
+    if (signbit(value))
+        out[len++] = '-';
+
+    // digits come out backwards, so build them in a small scratch first
+    char digits[32];
+    int numDigits = 0;
+    uint64_t whole = scaled / powers[precision];
+    uint64_t part = scaled % powers[precision];
+
+    for (int d = 0; d < precision; d++)
+    {
+        digits[numDigits++] = '0' + (part % 10);
+        part /= 10;
+    }
+    if (precision > 0)
+        digits[numDigits++] = '.';
+    do
+    {
+        digits[numDigits++] = '0' + (whole % 10);
+        whole /= 10;
+    } while (whole);
+
+    while (numDigits)
+    {
+        out[len++] = digits[--numDigits];
+    }
+
+    return len;
 }
 
 // out of date, useless
@@ -141,84 +362,499 @@ void matrix_out(float *matrix, int cols, int rows, char *outFileName)
 }*/
 
 // Takes ADDRESS of matrix (this is necessary for efficient swapping and avoiding memory leaks)
-// as well as dimensions of matrix, transfer rate, temperature, and thread count.
-// Performs one time step on the array using given temp/rate/dimensions.
-void matrix_step_parallel(float **matrix, float **tmpMatrix, int cols, int rows, float k, float base, int numThreads)
+// as well as dimensions of matrix, transfer rate, temperature, thread count, a
+// CHANGE_* norm to measure, CHANGE_NONE if not needed, the heater spans (NULL for none),
+// and the histogram and busy times to fill in (see struct StepOutputs), NULL if not needed.
+// Performs one time step on the array using given temp/rate/dimensions, heater cells
+// taking their temperature instead of being computed.
+// Returns how much the matrix changed over the step before this one (see matrix_change),
+// measured during the same sweep, or 0 when not measured.
+// Counting rows right after they are computed saves the histogram its own pass over
+// the matrix.
+float matrix_step_parallel(float **matrix, float **tmpMatrix, int cols, int rows, float k, float base, int numThreads,
+                           int norm, struct HeaterSpans *spans, struct StepOutputs *out)
 {
     float *newMatrix = *tmpMatrix;
     float *curMatrix = *matrix; // derefence address of matrix to usable form
+    struct Histogram *hist = out ? out->hist : NULL;
+    double *busy = out ? out->busy : NULL;
+
+    stencil_init(); // picks the SIMD kernel before any threads exist
 
-    // Each thread is given one "cell" (x/y coordinate) at a time
-    // and calculates the new temperature based on neighbors.
-    // This new value is stored in a temporary matrix, and doing this
+    // New temperatures are stored in a temporary matrix, and doing this
     // requires no writes to the original matrix. This means
     // there are no race conditions here, as no thread will write
     // where any other threat wants to write.
-    #pragma omp parallel for num_threads(numThreads) schedule(static) collapse(2)
-    for (int i = 0; i < rows; i++)
+    float maxChange = 0;
+    double sqChange = 0;
+
+    #pragma omp parallel num_threads(numThreads) reduction(max:maxChange) reduction(+:sqChange)
     {
-        for (int j = 0; j < cols; j++)
+        long *counts = hist ? (long *)calloc(HIST_BINS, sizeof(long)) : NULL;
+        double busyStart = busy ? omp_get_wtime() : 0;
+
+        // Interior first, each thread is given whole rows at a time so the
+        // row kernel can vectorize across them with no boundary checks at all.
+        #pragma omp for schedule(static) nowait
+        for (int i = 1; i < rows - 1; i++)
         {
-            newMatrix[j + (i * cols)] = 
-                (curMatrix[j + (i * cols)] + (k * matrix_sum_neighbors(curMatrix, j, i, cols, rows, base)) / 8.0) / 2.0;
+            matrix_row_heated(&newMatrix[1 + (i * cols)], &curMatrix[1 + ((i - 1) * cols)],
+                              &curMatrix[1 + (i * cols)], &curMatrix[1 + ((i + 1) * cols)], 1, cols - 1, k,
+                              spans, i, norm ? &maxChange : NULL, norm ? &sqChange : NULL);
+
+            if (counts)
+                histogram_count(hist, counts, &newMatrix[1 + (i * cols)], cols - 2);
+        }
+
+        // Then the perimeter, the only cells with out-of-bounds neighbors.
+        // Numbered top row, bottom row, then left and right columns between them.
+        int sideLen = rows > 2 ? rows - 2 : 0;
+        int bottomLen = rows > 1 ? cols : 0;
+        int rightLen = cols > 1 ? sideLen : 0;
+        int perimeter = cols + bottomLen + sideLen + rightLen;
+
+        // no barrier after, the end of the parallel region is one
+        #pragma omp for schedule(static) nowait
+        for (int p = 0; p < perimeter; p++)
+        {
+            int x, y;
+            if (p < cols)
+            {
+                x = p;
+                y = 0;
+            }
+            else if (p < cols + bottomLen)
+            {
+                x = p - cols;
+                y = rows - 1;
+            }
+            else if (p < cols + bottomLen + sideLen)
+            {
+                x = 0;
+                y = 1 + p - (cols + bottomLen);
+            }
+            else
+            {
+                x = cols - 1;
+                y = 1 + p - (cols + bottomLen + sideLen);
+            }
+
+            int idx = x + (y * cols);
+            if (norm)
+            {
+                float diff = fabsf(curMatrix[idx] - newMatrix[idx]);
+                maxChange = diff > maxChange ? diff : maxChange;
+                sqChange += diff * diff;
+            }
+
+            newMatrix[idx] = matrix_edge_cell(curMatrix, x, y, cols, rows, k, base);
+            if (spans)
+                heater_spans_row(spans, y, x, x + 1, &newMatrix[y * cols]);
+            if (counts)
+                histogram_count(hist, counts, &newMatrix[idx], 1);
+        }
+
+        if (busy)
+            busy[omp_get_thread_num()] += omp_get_wtime() - busyStart;
+
+        if (counts)
+        {
+            #pragma omp critical
+            histogram_merge(hist, counts);
+            free(counts);
         }
     }
 
     float *tmp = *matrix;
     *matrix = *tmpMatrix; // put tmpMatrix at the address of main matrix
     *tmpMatrix = tmp;
+
+    return matrix_change(norm, maxChange, sqChange);
 }
 
-// Takes a matrix (float *), coordinates, dimensions, and a default temperature.
-// Does not need parallelized as the smallest reasonable chunks each thread can do
-// are to calculate each index's neighbor sum.
-// Returns the sum of the coordinate's neighbors, defaulting out-of-bounds indices
-// to the default temperature.
-float matrix_sum_neighbors(float *matrix, int x, int y, int cols, int rows, float base)
+// Takes a CHANGE_* norm, and the largest and summed squared per cell changes.
+// Returns the change under that norm.
+// Step functions measure the change by reading the matrix they are about to
+// overwrite, which holds the step before the current one. So the value returned
+// by a step is the change from the previous step to the current one, and heaters
+// (clamped the same in both) never count as changing.
+float matrix_change(int norm, float maxChange, double sqChange)
 {
-    float sum = 0;
+    if (norm == CHANGE_MAX)
+        return maxChange;
+    if (norm == CHANGE_L2)
+        return sqrt(sqChange);
+
+    return 0;
+}
 
-    // sort of ugly, but makes the common case quite fast.
-    // very little comparisons/math overhead, just raw summing.
-    if (x > 0 && x < cols - 1 && y > 0 && y < rows - 1)
+// Takes current and new matrices (not addresses, nothing is swapped), dimensions,
+// row stride, transfer rate, temperature, whether the matrices are padded,
+// a range of rows, the heater spans (NULL for none), and where to accumulate the change
+// (NULLs to not measure it).
+// Calculates every cell of rows rowStart to rowEnd-1, edges included, into newMatrix.
+// Meant to be called by each thread of an already running team on its own rows,
+// so unlike the other step functions this one starts no threads itself, and
+// stencil_init must already have been called.
+void matrix_step_rows(float *curMatrix, float *newMatrix, int cols, int rows, int stride, float k, float base,
+                      int padded, int rowStart, int rowEnd, struct HeaterSpans *spans,
+                      float *maxChange, double *sqChange)
+{
+    matrix_step_block(curMatrix, newMatrix, cols, rows, stride, k, base, padded,
+                      rowStart, rowEnd, 0, cols, spans, maxChange, sqChange);
+}
+
+// Same as matrix_step_rows, but only calculates columns colStart to colEnd-1 of those rows.
+void matrix_step_block(float *curMatrix, float *newMatrix, int cols, int rows, int stride, float k, float base,
+                       int padded, int rowStart, int rowEnd, int colStart, int colEnd,
+                       struct HeaterSpans *spans, float *maxChange, double *sqChange)
+{
+    // columns the row kernel can do, perimeter columns of a packed matrix are left out
+    int kernelStart = colStart;
+    int kernelEnd = colEnd;
+    if (!padded)
+    {
+        kernelStart = colStart > 1 ? colStart : 1;
+        kernelEnd = colEnd < cols - 1 ? colEnd : cols - 1;
+    }
+
+    for (int i = rowStart; i < rowEnd; i++)
+    {
+        // ghost cells make every row of a padded matrix an interior row
+        if (padded)
+        {
+            matrix_row_heated(&newMatrix[colStart + (i * stride)], &curMatrix[colStart + ((i - 1) * stride)],
+                              &curMatrix[colStart + (i * stride)], &curMatrix[colStart + ((i + 1) * stride)],
+                              colStart, colEnd, k, spans, i, maxChange, sqChange);
+            continue;
+        }
+
+        if (i == 0 || i == rows - 1)
+        {
+            for (int j = colStart; j < colEnd; j++)
+            {
+                matrix_edge_update(curMatrix, newMatrix, j, i, cols, rows, k, base, maxChange, sqChange);
+            }
+            if (spans)
+                heater_spans_row(spans, i, colStart, colEnd, &newMatrix[i * stride]);
+            continue;
+        }
+
+        if (kernelEnd > kernelStart)
+        {
+            matrix_row_heated(&newMatrix[kernelStart + (i * stride)], &curMatrix[kernelStart + ((i - 1) * stride)],
+                              &curMatrix[kernelStart + (i * stride)], &curMatrix[kernelStart + ((i + 1) * stride)],
+                              kernelStart, kernelEnd, k, spans, i, maxChange, sqChange);
+        }
+
+        if (colStart == 0)
+            matrix_edge_update(curMatrix, newMatrix, 0, i, cols, rows, k, base, maxChange, sqChange);
+        if (colEnd == cols && cols > 1)
+            matrix_edge_update(curMatrix, newMatrix, cols - 1, i, cols, rows, k, base, maxChange, sqChange);
+        if (spans && colStart == 0)
+            heater_spans_row(spans, i, 0, 1, &newMatrix[i * stride]);
+        if (spans && colEnd == cols)
+            heater_spans_row(spans, i, cols - 1, cols, &newMatrix[i * stride]);
+    }
+}
+
+// Takes the new row and the current rows above, at and below it, all pointing at
+// column colStart, the matrix columns colStart to colEnd-1 to compute, transfer rate,
+// the heater spans (NULL for none) and which row this is, and where to accumulate the
+// change (NULLs to not measure it).
+// Runs the row kernel on the stretches between heaters, and copies the heaters'
+// temperatures over the rest, so heater cells are never computed. A heater holds the
+// same temperature in both matrices, so leaving it out of the change loses nothing.
+void matrix_row_heated(float *newRow, const float *up, const float *mid, const float *down, int colStart, int colEnd,
+                       float k, struct HeaterSpans *spans, int row, float *maxChange, double *sqChange)
+{
+    int col = colStart;
+
+    if (spans)
+    {
+        for (int s = heater_spans_find(spans, row, colStart);
+             s < spans->rowStart[row + 1] && spans->span[s].col < colEnd; s++)
+        {
+            struct HeaterSpan *span = &spans->span[s];
+            int start = span->col > colStart ? span->col : colStart;
+            int end = span->col + span->len < colEnd ? span->col + span->len : colEnd;
+
+            if (start > col)
+            {
+                int off = col - colStart;
+                if (maxChange)
+                    stencil_row_change(&newRow[off], &up[off], &mid[off], &down[off], start - col, k,
+                                       maxChange, sqChange);
+                else
+                    stencil_row(&newRow[off], &up[off], &mid[off], &down[off], start - col, k);
+            }
+
+            memcpy(&newRow[start - colStart], &spans->temps[span->temp + (start - span->col)],
+                   (end - start) * sizeof(float));
+            col = end;
+        }
+    }
+
+    if (colEnd > col)
     {
-        sum += matrix[x - 1 + ((y - 1) * cols)];
-        sum += matrix[x     + ((y - 1) * cols)];
-        sum += matrix[x - 1 + ( y      * cols)];
+        int off = col - colStart;
+        if (maxChange)
+            stencil_row_change(&newRow[off], &up[off], &mid[off], &down[off], colEnd - col, k, maxChange, sqChange);
+        else
+            stencil_row(&newRow[off], &up[off], &mid[off], &down[off], colEnd - col, k);
+    }
+}
 
-        sum += matrix[x + 1 + ((y + 1) * cols)];
-        sum += matrix[x     + ((y + 1) * cols)];
-        sum += matrix[x + 1 + ( y      * cols)];
+// Takes both (unpadded) matrices, a perimeter cell, dimensions, rate, temperature,
+// and where to accumulate the change (NULLs to not measure it).
+// Writes the cell's new temperature, measuring the change it overwrites first.
+void matrix_edge_update(float *curMatrix, float *newMatrix, int x, int y, int cols, int rows, float k, float base,
+                        float *maxChange, double *sqChange)
+{
+    int idx = x + (y * cols);
 
-        sum += matrix[x - 1 + ((y + 1) * cols)];
-        sum += matrix[x + 1 + ((y - 1) * cols)];
+    if (maxChange)
+    {
+        float diff = fabsf(curMatrix[idx] - newMatrix[idx]);
+        *maxChange = diff > *maxChange ? diff : *maxChange;
+        *sqChange += diff * diff;
+    }
 
-        return sum;
+    newMatrix[idx] = matrix_edge_cell(curMatrix, x, y, cols, rows, k, base);
+}
+
+// Takes ADDRESS of two padded matrices (from matrix_init_padded), dimensions,
+// row stride, transfer rate, thread count, a CHANGE_* norm to measure, the heater
+// spans (NULL for none), and the busy times to fill in (NULL for none).
+// Performs one time step, every cell going through the same row kernel since
+// the ghost cells stand in for out-of-bounds neighbors. Results are identical
+// to matrix_step_parallel on an unpadded matrix, and so is the return value.
+float matrix_step_padded(float **matrix, float **tmpMatrix, int cols, int rows, int stride, float k, int numThreads,
+                         int norm, struct HeaterSpans *spans, struct StepOutputs *out)
+{
+    float *newMatrix = *tmpMatrix;
+    float *curMatrix = *matrix;
+    double *busy = out ? out->busy : NULL;
+
+    stencil_init();
+
+    float maxChange = 0;
+    double sqChange = 0;
+
+    #pragma omp parallel num_threads(numThreads) reduction(max:maxChange) reduction(+:sqChange)
+    {
+        double busyStart = busy ? omp_get_wtime() : 0;
+
+        // no barrier after, the end of the parallel region is one
+        #pragma omp for schedule(static) nowait
+        for (int i = 0; i < rows; i++)
+        {
+            matrix_row_heated(&newMatrix[i * stride], &curMatrix[(i - 1) * stride], &curMatrix[i * stride],
+                              &curMatrix[(i + 1) * stride], 0, cols, k, spans, i,
+                              norm ? &maxChange : NULL, norm ? &sqChange : NULL);
+        }
+
+        if (busy)
+            busy[omp_get_thread_num()] += omp_get_wtime() - busyStart;
     }
 
-    // if above comparison failed, we are on some sort of edge.
-    // this loop will only be encountered a number of times equal to the
-    // perimeter of the matrix.
-    // basically just goes over the neighbors and picks out the bad ones.
+    float *tmp = *matrix;
+    *matrix = *tmpMatrix;
+    *tmpMatrix = tmp;
+
+    return matrix_change(norm, maxChange, sqChange);
+}
+
+// Takes ADDRESS of two matrices from matrix_init_half, dimensions, row stride, transfer
+// rate, thread count, a CHANGE_* norm to measure, the heater spans (NULL for none), the
+// STORAGE_* format they are stored in, and the busy times to fill in (NULL for none).
+// Same as matrix_step_padded, except the matrices hold 16 bit floats, so every step moves
+// half the bytes. Each thread walks its own band of rows, widening every row it reads to
+// floats once, into a window of three rows that rolls down the band. The float row kernel
+// runs on the window, and its result is rounded to 16 bits as it is stored, which is the
+// only place this differs from a float run.
+float matrix_step_half(uint16_t **matrix, uint16_t **tmpMatrix, int cols, int rows, int stride, float k,
+                       int numThreads, int norm, struct HeaterSpans *spans, int format, struct StepOutputs *out)
+{
+    uint16_t *newMatrix = *tmpMatrix;
+    uint16_t *curMatrix = *matrix;
+    double *busy = out ? out->busy : NULL;
+
+    stencil_init();
+    half_init();
+
+    float maxChange = 0;
+    double sqChange = 0;
+    int rowLen = cols + 2; // ghost cells on both ends
+
+    #pragma omp parallel num_threads(numThreads) reduction(max:maxChange) reduction(+:sqChange)
+    {
+        double busyStart = busy ? omp_get_wtime() : 0;
+        int thread = omp_get_thread_num();
+        int team = omp_get_num_threads();
+        int rowStart = (int)(((long)rows * thread) / team);
+        int rowEnd = (int)(((long)rows * (thread + 1)) / team);
+
+        // row r's widened copy sits in slot (r + 3) % 3, the output row after the three slots
+        float *wide = (float *)malloc(4 * (size_t)rowLen * sizeof(float));
+        float *outRow = &wide[3 * rowLen];
+
+        for (int i = rowStart - 1; i < rowStart + 1 && rowStart < rowEnd; i++)
+        {
+            half_to_float(&wide[((i + 3) % 3) * rowLen], &curMatrix[(i * stride) - 1], rowLen, format);
+        }
+
+        for (int i = rowStart; i < rowEnd; i++)
+        {
+            half_to_float(&wide[((i + 4) % 3) * rowLen], &curMatrix[((i + 1) * stride) - 1], rowLen, format);
+
+            if (norm)
+                half_to_float(outRow, &newMatrix[i * stride], cols, format);
+
+            matrix_row_heated(outRow, &wide[(((i + 2) % 3) * rowLen) + 1], &wide[((i % 3) * rowLen) + 1],
+                              &wide[(((i + 1) % 3) * rowLen) + 1], 0, cols, k, spans, i,
+                              norm ? &maxChange : NULL, norm ? &sqChange : NULL);
+
+            half_from_float(&newMatrix[i * stride], outRow, cols, format);
+        }
+
+        free(wide);
+        if (busy)
+            busy[thread] += omp_get_wtime() - busyStart;
+    }
+
+    uint16_t *tmp = *matrix;
+    *matrix = *tmpMatrix;
+    *tmpMatrix = tmp;
+
+    return matrix_change(norm, maxChange, sqChange);
+}
+
+// Temporally blocked version of matrix_step_parallel, takes the same arguments plus
+// the row stride (cols, or that of a padded matrix), the number of steps to fuse,
+// the heater spans to hold between those steps (NULL for none), and the busy times
+// to fill in (NULL for none).
+// Each thread copies a tile plus a halo "steps" cells wide into scratch memory,
+// and advances it "steps" times there. The halo shrinks by one cell per step,
+// so after the last step the tile's core is exact and is written back.
+// This trades a little redundant halo work for reading/writing the big matrix
+// once per "steps" timesteps instead of once every timestep.
+// Heater cells take their temperature in every step, including the last, so the
+// result matches calling matrix_step_parallel "steps" times.
+// Both use the same row kernel, so the match is exact down to rounding.
+void matrix_step_tiled(float **matrix, float **tmpMatrix, int cols, int rows, int stride, float k, float base,
+                       int numThreads, int steps, struct HeaterSpans *spans, struct StepOutputs *out)
+{
+    float *newMatrix = *tmpMatrix;
+    float *curMatrix = *matrix;
+    double *busy = out ? out->busy : NULL;
+
+    const int halo = steps;
+    const int ext = TILE_DIM + 2 * halo; // scratch row length, core plus halo on both sides
+    const int tilesX = (cols + TILE_DIM - 1) / TILE_DIM;
+    const int tilesY = (rows + TILE_DIM - 1) / TILE_DIM;
+
+    stencil_init();
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        double busyStart = busy ? omp_get_wtime() : 0;
+        float *src = (float *)malloc(ext * ext * sizeof(float));
+        float *dst = (float *)malloc(ext * ext * sizeof(float));
+
+        // tiles on the edge of the matrix have some halo hanging off of it,
+        // so work per tile varies a little, dynamic evens that out
+        // no barrier after, the end of the parallel region is one
+        #pragma omp for schedule(dynamic) nowait
+        for (int t = 0; t < tilesX * tilesY; t++)
+        {
+            // matrix coordinates of scratch cell 0,0, negative when hanging off the top/left
+            const int y0 = (t / tilesX) * TILE_DIM - halo;
+            const int x0 = (t % tilesX) * TILE_DIM - halo;
+            int coreH = rows - (y0 + halo);
+            int coreW = cols - (x0 + halo);
+            if (coreH > TILE_DIM)
+                coreH = TILE_DIM;
+            if (coreW > TILE_DIM)
+                coreW = TILE_DIM;
+
+            const int h = coreH + 2 * halo;
+            const int w = coreW + 2 * halo;
+
+            // cells outside of the matrix hold base, which is exactly what
+            // matrix_edge_cell substitutes for out-of-bounds neighbors
+            for (int i = 0; i < h; i++)
+            {
+                for (int j = 0; j < w; j++)
+                {
+                    int y = y0 + i;
+                    int x = x0 + j;
+                    if (x < 0 || x >= cols || y < 0 || y >= rows)
+                        src[j + (i * ext)] = base;
+                    else
+                        src[j + (i * ext)] = curMatrix[x + (y * stride)];
+                }
+            }
+            memcpy(dst, src, h * ext * sizeof(float));
+
+            for (int s = 1; s <= steps; s++)
+            {
+                // valid region shrinks by one each step, and never leaves the matrix
+                int iStart = s > -y0 ? s : -y0;
+                int iEnd = h - s < rows - y0 ? h - s : rows - y0;
+                int jStart = s > -x0 ? s : -x0;
+                int jEnd = w - s < cols - x0 ? w - s : cols - x0;
+
+                for (int i = iStart; i < iEnd; i++)
+                {
+                    matrix_row_heated(&dst[jStart + (i * ext)], &src[jStart + ((i - 1) * ext)],
+                                      &src[jStart + (i * ext)], &src[jStart + ((i + 1) * ext)],
+                                      x0 + jStart, x0 + jEnd, k, spans, y0 + i, NULL, NULL);
+                }
+
+                float *tmp = src;
+                src = dst;
+                dst = tmp;
+            }
+
+            for (int i = halo; i < halo + coreH; i++)
+            {
+                memcpy(&newMatrix[(x0 + halo) + ((y0 + i) * stride)], &src[halo + (i * ext)], coreW * sizeof(float));
+            }
+        }
+
+        free(src);
+        free(dst);
+        if (busy)
+            busy[omp_get_thread_num()] += omp_get_wtime() - busyStart;
+    }
+
+    float *tmp = *matrix;
+    *matrix = *tmpMatrix;
+    *tmpMatrix = tmp;
+}
+
+// Takes a matrix (float *), coordinates of a cell on its perimeter, dimensions,
+// transfer rate, and a default temperature.
+// Returns the new temperature of that cell, defaulting out-of-bounds neighbors
+// to the default temperature, rounded the same way the row kernels round.
+float matrix_edge_cell(float *matrix, int x, int y, int cols, int rows, float k, float base)
+{
+    float block[9]; // 3x3 around the cell, row by row
+
     for (int i = -1; i <= 1; i++)
     {
         for (int j = -1; j <= 1; j++)
         {
-            if (i == 0 && j == 0)
-                continue;
-
             int cur_x = x + j;
             int cur_y = y + i;
 
             if (cur_x < 0 || cur_x >= cols || cur_y < 0 || cur_y >= rows)
-            {
-                sum += base;
-                continue;
-            }
-
-            sum += matrix[cur_x + (cur_y * cols)];
+                block[(j + 1) + ((i + 1) * 3)] = base;
+            else
+                block[(j + 1) + ((i + 1) * 3)] = matrix[cur_x + (cur_y * cols)];
         }
     }
 
-    return sum;
-}
\ No newline at end of file
+    return stencil_cell(block[0], block[1], block[2], block[3], block[4], block[5], block[6], block[7], block[8], k);
+}
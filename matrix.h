@@ -2,14 +2,55 @@
 #define MATRIX_H
 
 #include "bmp.h"
+#include "heater.h"
+#include "histogram.h"
+#include "half.h"
+
+#define MATRIX_ALIGN 64                          // bytes, padded rows start on a cache line
+#define MATRIX_PAD ((int)(MATRIX_ALIGN / sizeof(float))) // floats of padding before each padded row
+
+#define CHANGE_NONE 0 // step functions skip measuring how much the matrix changed
+#define CHANGE_MAX 1  // largest absolute change of any one cell
+#define CHANGE_L2 2   // square root of the summed squared change of every cell
+
+// What a step function can hand back besides the change it returns. Either field
+// may be NULL when not wanted, and so may the whole struct.
+struct StepOutputs
+{
+    struct Histogram *hist; // counts the new values, only matrix_step_parallel fills it
+    double *busy;           // per thread seconds, each thread adds its own work time, leaving out waits
+};
 
 float *matrix_init_empty(int, int);
 float *matrix_init(int, int, float);
 float *matrix_init_parallel(int, int, float, int);
+float *matrix_init_padded(int, int, float);
+int matrix_padded_stride(int);
+void matrix_free(float *, int, int);
+uint16_t *matrix_init_half(int, int, float, int);
+void matrix_free_half(uint16_t *, int);
+void matrix_from_half(float *, uint16_t *, int, int, int, int, int);
+
+#define PRECISION_MAX 9 // digits after the decimal point matrix_out can write
 
-void matrix_out(float *, int, int, char *);
+void matrix_out(float *, int, int, int, int, int, char *);
+int matrix_format_cell(char *, float, int);
 
 void matrix_step(float *, int, int, float, float);
-void matrix_step_parallel(float **, float**, int, int, float, float, int);
+float matrix_step_parallel(float **, float**, int, int, float, float, int, int, struct HeaterSpans *,
+                           struct StepOutputs *);
+void matrix_step_rows(float *, float *, int, int, int, float, float, int, int, int, struct HeaterSpans *,
+                      float *, double *);
+void matrix_step_block(float *, float *, int, int, int, float, float, int, int, int, int, int,
+                       struct HeaterSpans *, float *, double *);
+void matrix_row_heated(float *, const float *, const float *, const float *, int, int, float,
+                       struct HeaterSpans *, int, float *, double *);
+float matrix_step_padded(float **, float **, int, int, int, float, int, int, struct HeaterSpans *,
+                         struct StepOutputs *);
+float matrix_change(int, float, double);
+float matrix_step_half(uint16_t **, uint16_t **, int, int, int, float, int, int, struct HeaterSpans *, int,
+                       struct StepOutputs *);
+void matrix_step_tiled(float **, float **, int, int, int, float, float, int, int, struct HeaterSpans *,
+                       struct StepOutputs *);
 
 #endif
@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "options.h"
+#include "matrix.h" // CHANGE_* norms
+#include "heatmap.h" // POOL_* modes
+#include "half.h" // STORAGE_* formats
+
+// Default options, matches the behaviour of running with no flags at all.
+struct Options options_init(void)
+{
+    struct Options opts;
+
+    opts.fuse = 1;
+    opts.padded = 0;
+    opts.storage = STORAGE_F32;
+    opts.persistent = 0;
+    opts.epsilon = 0;
+    opts.checkEvery = CHECK_EVERY_DEFAULT;
+    opts.norm = CHANGE_MAX;
+    opts.activeTiles = 0;
+    opts.activeThreshold = 0;
+    opts.csvOut = 1;
+    opts.binaryOut = 0;
+    opts.precision = 1;
+    opts.bmpOut = 1;
+    opts.pngOut = 0;
+    opts.pool = POOL_MEAN;
+    opts.tiles = 0;
+    opts.range = RANGE_DEFAULT;
+    opts.autoRange = 0;
+    opts.rangeLow = 1;
+    opts.rangeHigh = 99;
+    opts.snapshotEvery = 0;
+    opts.animateEvery = 0;
+    opts.frameSize = FRAME_SIZE_DEFAULT;
+    opts.checkpointEvery = 0;
+    opts.resume = 0;
+    opts.initialFile = NULL;
+    opts.profile = 0;
+    opts.profileFile = NULL;
+
+    return opts;
+}
+
+// Takes the options struct, and the leftover argc/argv after the positional arguments.
+// Switches stand alone, every other flag takes exactly one value after it.
+// Returns 0 on success, 1 if anything could not be understood.
+int options_parse(struct Options *opts, int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        char *name = argv[i];
+
+        if (!strcmp(name, "--persistent"))
+        {
+            opts->persistent = 1;
+            continue;
+        }
+        if (!strcmp(name, "--tiles"))
+        {
+            opts->tiles = 1;
+            continue;
+        }
+        if (!strcmp(name, "--resume"))
+        {
+            opts->resume = 1;
+            continue;
+        }
+        if (!strcmp(name, "--profile"))
+        {
+            opts->profile = 1;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            printf("Option %s is missing a value.\n", name);
+            return 1;
+        }
+
+        char *value = argv[++i];
+
+        if (!strcmp(name, "--fuse"))
+        {
+            opts->fuse = atoi(value);
+            if (opts->fuse < 1 || opts->fuse > FUSE_MAX)
+            {
+                printf("Invalid --fuse, choose a number of timesteps between 1 and %d.\n", FUSE_MAX);
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--layout"))
+        {
+            if (!strcmp(value, "padded"))
+                opts->padded = 1;
+            else if (!strcmp(value, "packed"))
+                opts->padded = 0;
+            else
+            {
+                printf("Invalid --layout, choose packed or padded.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--epsilon"))
+        {
+            char *ptr;
+            opts->epsilon = strtod(value, &ptr);
+            if (opts->epsilon <= 0)
+            {
+                printf("Invalid --epsilon, must be >0.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--check-every"))
+        {
+            opts->checkEvery = atoi(value);
+            if (opts->checkEvery < 1)
+            {
+                printf("Invalid --check-every, must be >0.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--norm"))
+        {
+            if (!strcmp(value, "max"))
+                opts->norm = CHANGE_MAX;
+            else if (!strcmp(value, "l2"))
+                opts->norm = CHANGE_L2;
+            else
+            {
+                printf("Invalid --norm, choose max or l2.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--active-tiles"))
+        {
+            char *ptr;
+            opts->activeTiles = 1;
+            opts->activeThreshold = strtod(value, &ptr);
+            if (opts->activeThreshold < 0)
+            {
+                printf("Invalid --active-tiles, threshold must be >=0.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--output"))
+        {
+            opts->csvOut = !strcmp(value, "csv") || !strcmp(value, "both");
+            opts->binaryOut = !strcmp(value, "binary") || !strcmp(value, "both");
+            if (!opts->csvOut && !opts->binaryOut)
+            {
+                printf("Invalid --output, choose csv, binary, or both.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--image"))
+        {
+            opts->bmpOut = !strcmp(value, "bmp") || !strcmp(value, "both");
+            opts->pngOut = !strcmp(value, "png") || !strcmp(value, "both");
+            if (!opts->bmpOut && !opts->pngOut)
+            {
+                printf("Invalid --image, choose bmp, png, or both.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--storage"))
+        {
+            if (!strcmp(value, "f32"))
+                opts->storage = STORAGE_F32;
+            else if (!strcmp(value, "f16"))
+                opts->storage = STORAGE_F16;
+            else if (!strcmp(value, "bf16"))
+                opts->storage = STORAGE_BF16;
+            else
+            {
+                printf("Invalid --storage, choose f32, f16, or bf16.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--pool"))
+        {
+            if (!strcmp(value, "mean"))
+                opts->pool = POOL_MEAN;
+            else if (!strcmp(value, "max"))
+                opts->pool = POOL_MAX;
+            else if (!strcmp(value, "min"))
+                opts->pool = POOL_MIN;
+            else
+            {
+                printf("Invalid --pool, choose mean, max, or min.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--precision"))
+        {
+            opts->precision = atoi(value);
+            if (opts->precision < 0 || opts->precision > PRECISION_MAX || value[0] < '0' || value[0] > '9')
+            {
+                printf("Invalid --precision, choose a number of digits between 0 and %d.\n", PRECISION_MAX);
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--snapshot-every"))
+        {
+            opts->snapshotEvery = atoi(value);
+            if (opts->snapshotEvery < 1)
+            {
+                printf("Invalid --snapshot-every, must be >0.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--animate"))
+        {
+            opts->animateEvery = atoi(value);
+            if (opts->animateEvery < 1)
+            {
+                printf("Invalid --animate, must be >0.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--frame-size"))
+        {
+            opts->frameSize = atoi(value);
+            if (opts->frameSize < 1 || opts->frameSize > 65535) // GIF sizes are 16 bit
+            {
+                printf("Invalid --frame-size, choose a number of pixels between 1 and 65535.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--checkpoint"))
+        {
+            char *ptr;
+            opts->checkpointEvery = strtod(value, &ptr);
+            if (opts->checkpointEvery <= 0)
+            {
+                printf("Invalid --checkpoint, must be >0 seconds.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--initial"))
+        {
+            opts->initialFile = value;
+        }
+        else if (!strcmp(name, "--profile-out"))
+        {
+            opts->profile = 1;
+            opts->profileFile = value;
+        }
+        else if (!strcmp(name, "--range"))
+        {
+            char *ptr;
+            opts->range = strtod(value, &ptr);
+            if (opts->range <= 0)
+            {
+                printf("Invalid --range, must be >0.\n");
+                return 1;
+            }
+        }
+        else if (!strcmp(name, "--auto-range"))
+        {
+            opts->autoRange = 1;
+            if (sscanf(value, "%f,%f", &opts->rangeLow, &opts->rangeHigh) != 2 || opts->rangeLow < 0 ||
+                opts->rangeHigh > 100 || opts->rangeLow >= opts->rangeHigh)
+            {
+                printf("Invalid --auto-range, choose two percentiles like 1,99.\n");
+                return 1;
+            }
+        }
+        else
+        {
+            printf("Unknown option %s.\n", name);
+            return 1;
+        }
+    }
+
+    if (opts->persistent && opts->fuse > 1)
+    {
+        printf("--persistent and --fuse can't be combined.\n");
+        return 1;
+    }
+
+    if (opts->activeTiles && (opts->fuse > 1 || opts->persistent))
+    {
+        printf("--active-tiles can't be combined with --fuse or --persistent.\n");
+        return 1;
+    }
+
+    if (opts->resume && opts->initialFile)
+    {
+        printf("--resume and --initial can't be combined.\n");
+        return 1;
+    }
+
+    // 16 bit grids have their own step, which is a plain padded sweep
+    if (opts->storage != STORAGE_F32)
+    {
+        if (opts->fuse > 1 || opts->persistent || opts->activeTiles)
+        {
+            printf("--storage f16/bf16 can't be combined with --fuse, --persistent, or --active-tiles.\n");
+            return 1;
+        }
+        opts->padded = 1;
+    }
+
+    // fused tiles never see the whole matrix between two steps
+    if (opts->epsilon > 0 && opts->fuse > 1)
+    {
+        printf("--epsilon and --fuse can't be combined.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Prints the optional flags, shown under the regular usage example.
+void options_usage(void)
+{
+    printf("Options:\n");
+    printf("  --fuse N           advance each cache-sized tile N timesteps at a time (1-%d, default 1)\n", FUSE_MAX);
+    printf("  --layout L         packed (default) or padded, a ghost cell border with cache line aligned rows\n");
+    printf("  --storage S        grid cells as f32 (default), or f16/bf16 to halve memory, computed in f32 either way\n");
+    printf("  --persistent       start the threads once for the whole run instead of once per timestep\n");
+    printf("  --epsilon E        stop early once the change per timestep falls below E\n");
+    printf("  --check-every N    timesteps between --epsilon checks (default %d)\n", CHECK_EVERY_DEFAULT);
+    printf("  --norm N           how change is measured for --epsilon, max (default) or l2\n");
+    printf("  --active-tiles T   skip tiles whose surroundings changed by T or less last step, 0 = exact\n");
+    printf("  --output O         csv (default), binary (outputFileName.grid, mmap-able), or both\n");
+    printf("  --image I          bmp (default), png (compressed, outputFileName.png), or both\n");
+    printf("  --pool P           how cells shrink into image pixels, mean (default), max (keeps hotspots), or min\n");
+    printf("  --range R          degrees from baseTemp drawn fully cold or hot in images (default %.0f)\n", RANGE_DEFAULT);
+    printf("  --auto-range L,H   pick the range so cells between the L and H percentiles aren't clipped, e.g. 1,99\n");
+    printf("  --tiles            also write 256x256 PNG tiles for zooming in, as outputFileName.tiles/z/x/y.png\n");
+    printf("  --precision N      digits after the decimal point in the CSV (0-%d, default 1)\n", PRECISION_MAX);
+    printf("  --snapshot-every N also write the outputs every N timesteps, as outputFileName.step<N>\n");
+    printf("  --animate N        draw a frame every N timesteps into an animated outputFileName.gif\n");
+    printf("  --frame-size S     longest side of an animation frame in pixels (default %d)\n", FRAME_SIZE_DEFAULT);
+    printf("  --checkpoint S     save a restart point to outputFileName.ckpt every S seconds\n");
+    printf("  --resume           continue from outputFileName.ckpt, with the same arguments as the run that saved it\n");
+    printf("  --initial F        start from grid file F (a .grid output or .ckpt) instead of baseTemp\n");
+    printf("  --profile          print time spent per phase, timestep percentiles, and per-thread busy time at exit\n");
+    printf("  --profile-out F    --profile, and also write it to F as JSON\n");
+}
@@ -0,0 +1,45 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#define FUSE_MAX 32 // past this the redundant halo work outweighs the cache savings
+#define CHECK_EVERY_DEFAULT 100
+#define FRAME_SIZE_DEFAULT 256 // small enough that drawing a frame costs far less than a timestep
+#define RANGE_DEFAULT 25.0     // degrees from base drawn fully low or high
+
+// Optional "--name value" flags that may follow the positional arguments.
+struct Options
+{
+    int fuse;       // timesteps advanced per tile before moving on, 1 = plain sweep
+    int padded;     // ghost cell border and cache line aligned rows, see matrix_init_padded
+    int storage;    // STORAGE_* from half.h, how the grids are kept between steps
+    int persistent; // one parallel region for the whole run instead of one per timestep
+    float epsilon;  // stop once the change per step falls below this, 0 = run every timestep
+    int checkEvery; // timesteps between convergence checks
+    int norm;       // CHANGE_* from matrix.h, how the change per step is measured
+    int activeTiles;       // only step tiles whose surroundings are still changing
+    float activeThreshold; // change at or below which a tile counts as settled
+    int csvOut;     // write the CSV file
+    int binaryOut;  // write the binary grid file, see gridfile.h
+    int precision;  // digits after the decimal point in the CSV
+    int bmpOut;     // write the heatmap as a BMP
+    int pngOut;     // write the heatmap as a compressed PNG
+    int pool;       // POOL_* from heatmap.h, how cells shrink into pixels in images smaller than the matrix
+    int tiles;      // also write a zoomable tile pyramid, see tiles.h
+    float range;    // degrees from base drawn fully low or high in the final images
+    int autoRange;  // pick range from the final matrix's percentiles instead, see histogram.h
+    float rangeLow, rangeHigh; // the percentiles, 0-100
+    int snapshotEvery; // timesteps between snapshots written in the background, 0 = none
+    int animateEvery;  // timesteps between animation frames, 0 = no animation
+    int frameSize;     // longest side of an animation frame, in pixels
+    float checkpointEvery; // seconds between checkpoints to outputFileName.ckpt, 0 = none
+    int resume;            // continue from outputFileName.ckpt instead of starting over
+    char *initialFile;     // grid file to start from instead of baseTemp, NULL = none
+    int profile;       // time the run's phases and steps, see profile.h
+    char *profileFile; // also write the profile here as JSON, NULL = print only
+};
+
+struct Options options_init(void);
+int options_parse(struct Options *, int, char **);
+void options_usage(void);
+
+#endif
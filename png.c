@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <zlib.h>
+#include "png.h"
+
+#define BYTES_PER_PIXEL 3 // rgb, no alpha
+
+void png_filter_row(unsigned char *, unsigned char *, unsigned char *, int);
+int png_predict(int, int, int, int);
+void png_put_int(unsigned char *, unsigned int);
+void png_chunk(FILE *, const char *, unsigned char *, unsigned int);
+
+// Takes a bgr image (first pixel of the top row, and the bytes from one row to the
+// next, as for render_map_float), its dimensions, thread count, the file name, and
+// where to put the file's size.
+// Splits the image into strips of rows. Each thread filters and deflates its strips
+// on its own, ending each with a sync flush instead of a final block, so the strips
+// joined in order are one valid deflate stream. Every strip goes in its own IDAT
+// chunk, and the stream's checksum is put together from the strips' with adler32_combine.
+// Returns 0 on success, 1 if the file could not be written.
+int png_write(unsigned char *img, int width, int height, long pitch, int numThreads, char *fileName,
+              size_t *fileSize)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (!file)
+        return 1;
+
+    long rowBytes = 1 + ((long)width * BYTES_PER_PIXEL); // filter type byte, then the row
+
+    int numStrips = height / PNG_STRIP_ROWS;
+    if (numStrips > numThreads * 4) // a few per thread to even out how well strips compress
+        numStrips = numThreads * 4;
+    if (numStrips < 1)
+        numStrips = 1;
+
+    unsigned char **stripOut = (unsigned char **)malloc(numStrips * sizeof(unsigned char *));
+    unsigned long *stripLen = (unsigned long *)malloc(numStrips * sizeof(unsigned long));
+    unsigned long *stripRaw = (unsigned long *)malloc(numStrips * sizeof(unsigned long));
+    unsigned long *stripAdler = (unsigned long *)malloc(numStrips * sizeof(unsigned long));
+    int failed = 0;
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        unsigned char *filtered = (unsigned char *)malloc(rowBytes * ((height / numStrips) + 1));
+        unsigned char *prevRow = (unsigned char *)malloc(rowBytes);
+        unsigned char *curRow = (unsigned char *)malloc(rowBytes);
+
+        #pragma omp for schedule(dynamic)
+        for (int s = 0; s < numStrips; s++)
+        {
+            int rowStart = (int)(((long)height * s) / numStrips);
+            int rowEnd = (int)(((long)height * (s + 1)) / numStrips);
+
+            // rows are swapped to rgb first, the filters look at the row above,
+            // which for the first row of a strip is the last row of the one before
+            memset(prevRow, 0, rowBytes);
+            for (int i = (rowStart > 0 ? rowStart - 1 : rowStart); i < rowEnd; i++)
+            {
+                unsigned char *src = img + (i * pitch);
+                for (int j = 0; j < width; j++)
+                {
+                    curRow[1 + (j * 3) + 0] = src[(j * 3) + 2];
+                    curRow[1 + (j * 3) + 1] = src[(j * 3) + 1];
+                    curRow[1 + (j * 3) + 2] = src[(j * 3) + 0];
+                }
+
+                if (i >= rowStart)
+                    png_filter_row(&filtered[(i - rowStart) * rowBytes], curRow, prevRow, width);
+
+                unsigned char *tmp = prevRow;
+                prevRow = curRow;
+                curRow = tmp;
+            }
+
+            unsigned long raw = (rowEnd - rowStart) * rowBytes;
+            stripRaw[s] = raw;
+            stripAdler[s] = adler32(adler32(0L, Z_NULL, 0), filtered, raw);
+
+            // room for the chunk's length and type, the zlib header, the data, and the crc
+            unsigned long bound = deflateBound(NULL, raw) + 64;
+            unsigned char *out = (unsigned char *)malloc(bound);
+            unsigned long header = 8 + (s == 0 ? 2 : 0);
+
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            deflateInit2(&zs, PNG_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY); // raw, no zlib wrapper
+            zs.next_in = filtered;
+            zs.avail_in = raw;
+            zs.next_out = out + header;
+            zs.avail_out = bound - header - 4;
+            if (deflate(&zs, s == numStrips - 1 ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR || zs.avail_in)
+            {
+                #pragma omp atomic write
+                failed = 1;
+            }
+            unsigned long len = zs.total_out + header - 8;
+            deflateEnd(&zs);
+
+            if (s == 0)
+            {
+                out[8] = 0x78; // deflate, 32K window
+                out[9] = 0x9C; // default compression, no dictionary, checked
+            }
+            png_put_int(out, len);
+            memcpy(out + 4, "IDAT", 4);
+            png_put_int(out + 8 + len, crc32(crc32(0L, Z_NULL, 0), out + 4, len + 4));
+
+            stripOut[s] = out;
+            stripLen[s] = len + 12;
+        }
+
+        free(filtered);
+        free(prevRow);
+        free(curRow);
+    }
+
+    unsigned char ihdr[13] = {0};
+    png_put_int(ihdr, width);
+    png_put_int(ihdr + 4, height);
+    ihdr[8] = 8; // bits per channel
+    ihdr[9] = 2; // rgb
+
+    fwrite("\x89PNG\r\n\x1a\n", 1, 8, file);
+    png_chunk(file, "IHDR", ihdr, 13);
+
+    unsigned long adler = stripAdler[0];
+    for (int s = 0; s < numStrips; s++)
+    {
+        if (s > 0)
+            adler = adler32_combine(adler, stripAdler[s], stripRaw[s]);
+        fwrite(stripOut[s], 1, stripLen[s], file);
+        free(stripOut[s]);
+    }
+
+    // the stream's checksum comes after the last strip, in one more small chunk
+    unsigned char trailer[4];
+    png_put_int(trailer, adler);
+    png_chunk(file, "IDAT", trailer, 4);
+    png_chunk(file, "IEND", NULL, 0);
+
+    *fileSize = ftell(file);
+    failed |= ferror(file) != 0;
+    failed |= fclose(file) != 0;
+
+    free(stripOut);
+    free(stripLen);
+    free(stripRaw);
+    free(stripAdler);
+
+    return failed;
+}
+
+// Takes where the filtered row goes (filter type byte first), the row and the one
+// above it (both starting with a spare byte), and the width.
+// Tries every PNG filter and keeps the one whose output is closest to all zeroes,
+// the usual rule of thumb for what deflate will compress best.
+void png_filter_row(unsigned char *out, unsigned char *row, unsigned char *above, int width)
+{
+    int n = width * BYTES_PER_PIXEL;
+    unsigned char *cur = row + 1;
+    unsigned char *up = above + 1;
+    long bestSum = -1;
+    int bestType = 0;
+
+    for (int type = 0; type < 5; type++)
+    {
+        long sum = 0;
+        for (int x = 0; x < n; x++)
+        {
+            int a = x >= BYTES_PER_PIXEL ? cur[x - BYTES_PER_PIXEL] : 0;
+            int b = up[x];
+            int c = x >= BYTES_PER_PIXEL ? up[x - BYTES_PER_PIXEL] : 0;
+            signed char v = (signed char)(cur[x] - png_predict(type, a, b, c));
+            sum += abs(v);
+        }
+
+        if (bestSum < 0 || sum < bestSum)
+        {
+            bestSum = sum;
+            bestType = type;
+        }
+    }
+
+    out[0] = bestType;
+    for (int x = 0; x < n; x++)
+    {
+        int a = x >= BYTES_PER_PIXEL ? cur[x - BYTES_PER_PIXEL] : 0;
+        int b = up[x];
+        int c = x >= BYTES_PER_PIXEL ? up[x - BYTES_PER_PIXEL] : 0;
+        out[1 + x] = cur[x] - png_predict(bestType, a, b, c);
+    }
+}
+
+// Takes a PNG filter type, and the bytes to the left, above, and above-left.
+// Returns what that filter predicts the byte to be.
+int png_predict(int type, int a, int b, int c)
+{
+    switch (type)
+    {
+        case 1: return a;
+        case 2: return b;
+        case 3: return (a + b) / 2;
+        case 4:
+        {
+            int p = a + b - c;
+            int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+        }
+    }
+
+    return 0;
+}
+
+// Writes a big endian 32 bit number, PNG's only integer order.
+void png_put_int(unsigned char *out, unsigned int value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// Writes one whole chunk, length, type, data and crc.
+void png_chunk(FILE *file, const char *type, unsigned char *data, unsigned int len)
+{
+    unsigned char header[8];
+    png_put_int(header, len);
+    memcpy(header + 4, type, 4);
+
+    unsigned long crc = crc32(crc32(0L, Z_NULL, 0), header + 4, 4);
+    if (len)
+        crc = crc32(crc, data, len);
+
+    unsigned char footer[4];
+    png_put_int(footer, crc);
+
+    fwrite(header, 1, 8, file);
+    if (len)
+        fwrite(data, 1, len, file);
+    fwrite(footer, 1, 4, file);
+}
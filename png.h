@@ -0,0 +1,11 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include <stddef.h>
+
+#define PNG_LEVEL 6            // zlib compression level, heatmaps are smooth so more buys little
+#define PNG_STRIP_ROWS 64      // fewest rows one thread compresses as a strip
+
+int png_write(unsigned char *, int, int, long, int, char *, size_t *);
+
+#endif
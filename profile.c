@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <omp.h>
+#include "profile.h"
+
+#define PROFILE_SHIFT 18 // float bits >> this are the power of two then log2(PROFILE_STEPS) mantissa bits
+#define PROFILE_BITS_MIN ((127 + PROFILE_EXP_MIN) * PROFILE_STEPS)
+
+int profile_bin(float);
+float profile_edge(int);
+void profile_write(struct Profile *, FILE *);
+
+const char *phaseNames[] = {"heaters", "setup", "steps", "finish", "csv", "grid", "tiles", "bmp", "png"};
+
+// Takes the thread count the steps run with.
+// Returns an empty profile, timing nothing until the first profile_phase.
+struct Profile *profile_init(int numThreads)
+{
+    struct Profile *profile = (struct Profile *)calloc(1, sizeof(*profile));
+    profile->current = PHASE_NONE;
+    profile->threads = numThreads;
+    profile->busy = (double *)calloc(numThreads, sizeof(double));
+    return profile;
+}
+
+// Takes the profile (NULL when not profiling, which does nothing) and a PHASE_*.
+// Ends the phase being timed and starts timing the given one, PHASE_NONE for none.
+// A phase entered more than once adds up.
+void profile_phase(struct Profile *profile, int phase)
+{
+    if (!profile)
+        return;
+
+    double now = omp_get_wtime(); // monotonic wall clock
+    if (profile->current != PHASE_NONE)
+        profile->phase[profile->current] += now - profile->mark;
+
+    profile->current = phase;
+    profile->mark = now;
+}
+
+// Takes the profile, how long a call to a step function took, and how many timesteps it did.
+// Counts each of them as taking an equal share.
+void profile_step(struct Profile *profile, double seconds, int steps)
+{
+    double each = seconds / steps;
+    if (!profile->steps || each < profile->stepMin)
+        profile->stepMin = each;
+    if (!profile->steps || each > profile->stepMax)
+        profile->stepMax = each;
+
+    profile->stepCounts[profile_bin(each)] += steps;
+    profile->steps += steps;
+    profile->stepTotal += seconds;
+}
+
+// Takes the profile and a percentile, 0 to 100.
+// Returns the timestep time at or below which that share of the steps lie, the top edge
+// of its bin, clamped to the slowest step actually seen.
+double profile_percentile(struct Profile *profile, float percentile)
+{
+    long target = (long)((percentile / 100.0) * profile->steps);
+    long seen = 0;
+    int bin = 0;
+
+    for (; bin < PROFILE_BINS - 1; bin++)
+    {
+        seen += profile->stepCounts[bin];
+        if (seen > target)
+            break;
+    }
+
+    double edge = profile_edge(bin);
+    return edge > profile->stepMax ? profile->stepMax : edge;
+}
+
+// Takes the profile (NULL when not profiling, which does nothing), and a file to also
+// write it to as JSON, NULL for none.
+// Stops timing, prints the summary, and frees the profile.
+void profile_finish(struct Profile *profile, char *fileName)
+{
+    if (!profile)
+        return;
+    profile_phase(profile, PHASE_NONE);
+
+    double total = 0;
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        total += profile->phase[p];
+    }
+
+    printf("\nProfile, wall time:\n");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (profile->phase[p] > 0)
+            printf("  %-8s %10.4f s %6.1f%%\n", phaseNames[p], profile->phase[p],
+                   100.0 * profile->phase[p] / total);
+    }
+    printf("  %-8s %10.4f s\n", "total", total);
+
+    if (profile->steps)
+    {
+        printf("Timestep, %ld steps: mean %.3f ms, min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+               profile->steps, 1e3 * profile->stepTotal / profile->steps, 1e3 * profile->stepMin,
+               1e3 * profile_percentile(profile, 50), 1e3 * profile_percentile(profile, 90),
+               1e3 * profile_percentile(profile, 99), 1e3 * profile->stepMax);
+    }
+
+    // every way of stepping measures its threads, a run with no timesteps has nothing to show
+    double busiest = 0, busySum = 0;
+    for (int t = 0; t < profile->threads; t++)
+    {
+        busiest = profile->busy[t] > busiest ? profile->busy[t] : busiest;
+        busySum += profile->busy[t];
+    }
+    if (busiest > 0)
+    {
+        printf("Thread busy time in the steps:\n");
+        for (int t = 0; t < profile->threads; t++)
+        {
+            printf("  thread %-3d %10.4f s %6.1f%% of the busiest\n", t, profile->busy[t],
+                   100.0 * profile->busy[t] / busiest);
+        }
+        printf("  imbalance: the busiest thread worked %.1f%% longer than the average\n",
+               100.0 * (busiest / (busySum / profile->threads) - 1));
+    }
+
+    if (fileName)
+    {
+        FILE *out = fopen(fileName, "w");
+        if (out)
+        {
+            profile_write(profile, out);
+            fclose(out);
+            printf("Profile saved to:\t\t%s\n", fileName);
+        }
+        else
+        {
+            printf("ERROR: Profile could not be written to %s.\n", fileName);
+        }
+    }
+
+    free(profile->busy);
+    free(profile);
+}
+
+// Takes the profile and an open file, writes the profile as one JSON object,
+// times in seconds.
+void profile_write(struct Profile *profile, FILE *out)
+{
+    fprintf(out, "{\n  \"phases\": {");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        fprintf(out, "%s\"%s\": %.9g", p ? ", " : "", phaseNames[p], profile->phase[p]);
+    }
+    fprintf(out, "},\n");
+
+    fprintf(out, "  \"steps\": {\"count\": %ld, \"total\": %.9g, \"min\": %.9g, \"p50\": %.9g, \"p90\": %.9g, "
+            "\"p99\": %.9g, \"max\": %.9g},\n", profile->steps, profile->stepTotal, profile->stepMin,
+            profile_percentile(profile, 50), profile_percentile(profile, 90), profile_percentile(profile, 99),
+            profile->stepMax);
+
+    fprintf(out, "  \"thread_busy\": [");
+    for (int t = 0; t < profile->threads; t++)
+    {
+        fprintf(out, "%s%.9g", t ? ", " : "", profile->busy[t]);
+    }
+    fprintf(out, "]\n}\n");
+}
+
+// Takes a timestep time in seconds, returns its bin.
+// Same trick as histogram_bin, the top bits of a positive float count up evenly in log space.
+int profile_bin(float seconds)
+{
+    uint32_t bits;
+    memcpy(&bits, &seconds, sizeof(bits));
+
+    int bin = (int)(bits >> PROFILE_SHIFT) - PROFILE_BITS_MIN;
+    return bin < 0 ? 0 : (bin >= PROFILE_BINS ? PROFILE_BINS - 1 : bin);
+}
+
+// Takes a bin, returns the time at its top edge.
+float profile_edge(int bin)
+{
+    uint32_t bits = (uint32_t)(bin + 1 + PROFILE_BITS_MIN) << PROFILE_SHIFT;
+    float seconds;
+    memcpy(&seconds, &bits, sizeof(seconds));
+
+    return seconds;
+}
@@ -0,0 +1,45 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Parts of a run --profile times, in the order they happen.
+#define PHASE_NONE -1
+#define PHASE_HEATERS 0 // heater_load and heater_spans_init
+#define PHASE_SETUP 1   // matrices, seeding, the snapshot writer
+#define PHASE_STEPS 2   // the timestep loop
+#define PHASE_FINISH 3  // widening 16 bit grids, the last histogram pass, waiting on the snapshot writer
+#define PHASE_CSV 4     // matrix_out
+#define PHASE_GRID 5    // gridfile_write
+#define PHASE_TILES 6   // tiles_write
+#define PHASE_BMP 7     // generate_bmp_float, rendering and writing are one pass
+#define PHASE_PNG 8     // generate_png_float
+#define PHASE_COUNT 9
+
+// Timestep times are binned on a log scale like histogram.h, so percentiles need no
+// array the length of the run: PROFILE_STEPS bins per power of two of seconds.
+#define PROFILE_STEPS 32   // bins per power of two, each about 2% wide
+#define PROFILE_EXP_MIN -30 // about a nanosecond, shorter steps share the first bin
+#define PROFILE_EXP_MAX 10  // about 17 minutes, longer ones share the last
+#define PROFILE_BINS (PROFILE_STEPS * (PROFILE_EXP_MAX - PROFILE_EXP_MIN))
+
+// Wall time of each phase, each timestep, and each thread's share of the steps, for --profile.
+struct Profile
+{
+    double phase[PHASE_COUNT]; // seconds spent in each
+    int current;               // phase being timed, PHASE_NONE before the first
+    double mark;               // omp_get_wtime when it started
+
+    long stepCounts[PROFILE_BINS];
+    long steps;
+    double stepTotal, stepMin, stepMax;
+
+    int threads;
+    double *busy; // seconds each thread spent computing inside the steps, not waiting at barriers
+};
+
+struct Profile *profile_init(int);
+void profile_phase(struct Profile *, int);
+void profile_step(struct Profile *, double, int);
+double profile_percentile(struct Profile *, float);
+void profile_finish(struct Profile *, char *);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "snapshot.h"
+#include "matrix.h"
+#include "gridfile.h"
+#include "heatmap.h"
+
+void *snapshot_writer(void *);
+void snapshot_write(struct SnapshotWriter *, float *, int);
+void snapshot_frame(struct SnapshotWriter *, float *);
+int snapshot_palette_index(struct SnapshotWriter *, unsigned char *);
+
+// Takes dimensions, stride, run parameters, which files to write, CSV precision,
+// image size (0 for no image), which image files, image colors, POOL_* mode, color range,
+// the output file name, and the checkpoint file name.
+// Allocates the queue slots up front, so memory stays fixed however far the
+// writer falls behind, and starts the writer thread.
+// Returns the writer, or NULL if the slots or thread could not be had.
+struct SnapshotWriter *snapshot_init(int cols, int rows, int stride, float base, float k, int csvOut,
+                                     int binaryOut, int precision, int imgW, int imgH, int bmpOut, int pngOut,
+                                     unsigned char *colors, int pool, float range, char *outFileName,
+                                     char *checkpointName)
+{
+    struct SnapshotWriter *sw = calloc(1, sizeof(*sw));
+
+    sw->cols = cols;
+    sw->rows = rows;
+    sw->stride = stride;
+    sw->base = base;
+    sw->k = k;
+    sw->csvOut = csvOut;
+    sw->binaryOut = binaryOut;
+    sw->precision = precision;
+    sw->imgW = imgW;
+    sw->imgH = imgH;
+    sw->bmpOut = bmpOut;
+    sw->pngOut = pngOut;
+    sw->colors = colors;
+    sw->pool = pool;
+    sw->range = range;
+    sw->outFileName = outFileName;
+    sw->checkpointName = checkpointName;
+
+    for (int s = 0; s < SNAPSHOT_QUEUE_MAX; s++)
+    {
+        sw->slots[s] = (float *)malloc((size_t)rows * stride * sizeof(float));
+        if (!sw->slots[s])
+        {
+            for (int f = 0; f < s; f++)
+                free(sw->slots[f]);
+            free(sw);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->changed, NULL);
+    if (pthread_create(&sw->thread, NULL, snapshot_writer, sw))
+    {
+        for (int s = 0; s < SNAPSHOT_QUEUE_MAX; s++)
+            free(sw->slots[s]);
+        free(sw);
+        return NULL;
+    }
+
+    return sw;
+}
+
+// Takes the writer, the animation's file name, and the longest side of a frame in pixels.
+// Opens the GIF, frames are then added by pushing with SNAPSHOT_FRAME. Frames keep the
+// matrix's aspect ratio, and are never drawn bigger than the matrix itself.
+// Returns 0 on success, 1 if the file could not be opened.
+int snapshot_animate(struct SnapshotWriter *sw, char *fileName, int frameSize)
+{
+    int longest = sw->cols > sw->rows ? sw->cols : sw->rows;
+    if (frameSize > longest)
+        frameSize = longest;
+
+    sw->frameW = ((long)sw->cols * frameSize) / longest;
+    sw->frameH = ((long)sw->rows * frameSize) / longest;
+    if (sw->frameW < 1)
+        sw->frameW = 1;
+    if (sw->frameH < 1)
+        sw->frameH = 1;
+
+    // 256 steps along the same low -> norm -> high gradient the heatmap draws with,
+    // colors are stored b,g,r and the palette wants r,g,b
+    for (int i = 0; i < GIF_COLORS; i++)
+    {
+        float t = (i / ((GIF_COLORS - 1) / 2.0f)) - 1;
+        unsigned char *far = t < 0 ? &sw->colors[0] : &sw->colors[6];
+        float w = fabsf(t);
+
+        for (int c = 0; c < 3; c++)
+        {
+            sw->palette[(i * 3) + 2 - c] = sw->colors[3 + c] * (1.0 - w) + (far[c] * w);
+        }
+    }
+
+    sw->gif = gif_open(fileName, sw->frameW, sw->frameH, sw->palette, SNAPSHOT_FRAME_DELAY);
+    return sw->gif == NULL;
+}
+
+// Takes the writer, the current matrix (heaters filled in), the timestep it is at,
+// and SNAPSHOT_* flags for what to make of it.
+// Copies the matrix into a free slot with one memcpy and hands it to the writer.
+// Only blocks when SNAPSHOT_QUEUE_MAX snapshots are already waiting.
+void snapshot_push(struct SnapshotWriter *sw, float *matrix, int timestep, int what)
+{
+    pthread_mutex_lock(&sw->lock);
+    while (sw->count == SNAPSHOT_QUEUE_MAX)
+        pthread_cond_wait(&sw->changed, &sw->lock);
+    int slot = (sw->head + sw->count) % SNAPSHOT_QUEUE_MAX;
+    pthread_mutex_unlock(&sw->lock);
+
+    // the writer never touches a free slot, so the copy needs no lock
+    memcpy(sw->slots[slot], matrix, (size_t)sw->rows * sw->stride * sizeof(float));
+
+    pthread_mutex_lock(&sw->lock);
+    sw->slotStep[slot] = timestep;
+    sw->slotWhat[slot] = what;
+    sw->count++;
+    pthread_cond_broadcast(&sw->changed);
+    pthread_mutex_unlock(&sw->lock);
+}
+
+// Takes the writer and where to put the number of animation frames, waits for every
+// queued snapshot to be written, ends the animation if there is one, then frees it.
+// Returns how many snapshots were written, or -1 if the animation failed to write.
+int snapshot_finish(struct SnapshotWriter *sw, int *frames)
+{
+    pthread_mutex_lock(&sw->lock);
+    sw->done = 1;
+    pthread_cond_broadcast(&sw->changed);
+    pthread_mutex_unlock(&sw->lock);
+
+    pthread_join(sw->thread, NULL);
+
+    int written = sw->written;
+    *frames = sw->frames;
+    if (sw->gif && gif_close(sw->gif))
+        written = -1;
+    for (int s = 0; s < SNAPSHOT_QUEUE_MAX; s++)
+        free(sw->slots[s]);
+    pthread_mutex_destroy(&sw->lock);
+    pthread_cond_destroy(&sw->changed);
+    free(sw);
+
+    return written;
+}
+
+// Writer thread, writes full slots oldest first until told there are no more.
+void *snapshot_writer(void *arg)
+{
+    struct SnapshotWriter *sw = (struct SnapshotWriter *)arg;
+
+    pthread_mutex_lock(&sw->lock);
+    for (;;)
+    {
+        while (sw->count == 0 && !sw->done)
+            pthread_cond_wait(&sw->changed, &sw->lock);
+        if (sw->count == 0)
+            break;
+
+        int slot = sw->head;
+        int what = sw->slotWhat[slot];
+        pthread_mutex_unlock(&sw->lock);
+
+        if (what & SNAPSHOT_FILES)
+            snapshot_write(sw, sw->slots[slot], sw->slotStep[slot]);
+        if ((what & SNAPSHOT_FRAME) && sw->gif)
+            snapshot_frame(sw, sw->slots[slot]);
+        if ((what & SNAPSHOT_CHECKPOINT) &&
+            gridfile_checkpoint(sw->slots[slot], sw->cols, sw->rows, sw->stride, sw->base, sw->k,
+                                sw->slotStep[slot], sw->checkpointName))
+            printf("ERROR: Checkpoint could not be written to %s.\n", sw->checkpointName);
+
+        pthread_mutex_lock(&sw->lock);
+        sw->head = (sw->head + 1) % SNAPSHOT_QUEUE_MAX;
+        sw->count--;
+        sw->written += (what & SNAPSHOT_FILES) != 0;
+        sw->frames += (what & SNAPSHOT_FRAME) != 0;
+        pthread_cond_broadcast(&sw->changed);
+    }
+    pthread_mutex_unlock(&sw->lock);
+
+    return NULL;
+}
+
+// Takes the writer, a copied matrix, and its timestep.
+// Writes the same files the end of the run does, named outFileName.step<N>.
+void snapshot_write(struct SnapshotWriter *sw, float *matrix, int timestep)
+{
+    char *name = (char *)malloc(strlen(sw->outFileName) + 32);
+    int len = sprintf(name, "%s.step%d", sw->outFileName, timestep);
+
+    // one thread, the simulation has the rest of the cores
+    if (sw->csvOut)
+        matrix_out(matrix, sw->cols, sw->rows, sw->stride, sw->precision, 1, name);
+
+    if (sw->binaryOut)
+    {
+        strcpy(&name[len], ".grid");
+        if (gridfile_write(matrix, sw->cols, sw->rows, sw->stride, sw->base, sw->k, timestep, name))
+            printf("ERROR: Binary grid file could not be written to %s.\n", name);
+    }
+
+    if (sw->imgW > 0 && sw->pngOut)
+    {
+        size_t size;
+        strcpy(&name[len], ".png");
+        if (generate_png_float(matrix, sw->cols, sw->rows, sw->stride, sw->imgW, sw->imgH, sw->base, sw->range,
+                               sw->colors, sw->pool, 1, name, &size))
+            printf("ERROR: PNG heatmap image could not be written to %s.\n", name);
+    }
+
+    if (sw->imgW > 0 && sw->bmpOut)
+    {
+        strcpy(&name[len], ".bmp");
+        if (generate_bmp_float(matrix, sw->cols, sw->rows, sw->stride, sw->imgW, sw->imgH, sw->base, sw->range,
+                               sw->colors, sw->pool, 1, name))
+            printf("ERROR: BMP heatmap image could not be written to %s.\n", name);
+    }
+
+    free(name);
+}
+
+// Takes the writer and a copied matrix.
+// Renders it through the regular heatmap path at frame size, which pools the
+// cells under each frame pixel before coloring it, and adds it to the animation.
+void snapshot_frame(struct SnapshotWriter *sw, float *matrix)
+{
+    unsigned char *heatmap = generate_map_float(matrix, sw->cols, sw->rows, sw->stride, sw->frameW, sw->frameH,
+                                                sw->base, sw->range, sw->colors, sw->pool, 1);
+
+    // indices are written over the start of the bgr pixels they came from
+    int count = sw->frameW * sw->frameH;
+    for (int p = 0; p < count; p++)
+    {
+        heatmap[p] = snapshot_palette_index(sw, &heatmap[p * 3]);
+    }
+
+    gif_frame(sw->gif, heatmap);
+    free(heatmap);
+}
+
+// Takes the writer and a b,g,r pixel.
+// Heatmap pixels lie on (or, off the LUT's rounding, near) the two lines norm -> low and norm -> high,
+// so projecting onto the nearer line finds its place on the palette's gradient.
+// Returns the palette index.
+int snapshot_palette_index(struct SnapshotWriter *sw, unsigned char *pixel)
+{
+    float bestT = 0, bestDist = -1;
+
+    for (int side = -1; side <= 1; side += 2)
+    {
+        unsigned char *far = side < 0 ? &sw->colors[0] : &sw->colors[6];
+        float d[3], v[3], dd = 0, dv = 0;
+
+        for (int c = 0; c < 3; c++)
+        {
+            d[c] = far[c] - sw->colors[3 + c];
+            v[c] = pixel[c] - sw->colors[3 + c];
+            dd += d[c] * d[c];
+            dv += d[c] * v[c];
+        }
+
+        float t = dd > 0 ? dv / dd : 0;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+
+        float dist = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            float e = v[c] - (t * d[c]);
+            dist += e * e;
+        }
+
+        if (bestDist < 0 || dist < bestDist)
+        {
+            bestDist = dist;
+            bestT = side * t;
+        }
+    }
+
+    return (int)(((bestT + 1) * ((GIF_COLORS - 1) / 2.0f)) + 0.5f);
+}
@@ -0,0 +1,56 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include "gif.h"
+
+#define SNAPSHOT_QUEUE_MAX 2   // copies waiting to be written, compute blocks past this
+#define SNAPSHOT_FRAME_DELAY 8 // hundredths of a second each animation frame is shown
+
+// what a pushed copy is for, both may be asked for at once
+#define SNAPSHOT_FILES 1 // CSV/grid/BMP files, like the end of the run writes
+#define SNAPSHOT_FRAME 2 // one more frame of the animation
+#define SNAPSHOT_CHECKPOINT 4 // a restart point for --resume, see gridfile_checkpoint
+
+// Background writer for --snapshot-every, --animate and --checkpoint. The simulation
+// copies the matrix into a free slot and moves on, a single writer thread turns full
+// slots into files, animation frames and checkpoints.
+struct SnapshotWriter
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // a slot was filled or emptied, or the run ended
+
+    float *slots[SNAPSHOT_QUEUE_MAX]; // rows * stride copies of the matrix
+    int slotStep[SNAPSHOT_QUEUE_MAX]; // timestep each slot was taken at
+    int slotWhat[SNAPSHOT_QUEUE_MAX]; // SNAPSHOT_* flags
+    int head;                         // oldest full slot
+    int count;                        // full slots
+    int done;                         // no more snapshots coming
+
+    int cols, rows, stride;
+    float base, k;
+    int csvOut, binaryOut, precision;
+    int imgW, imgH;          // 0 = no image
+    int bmpOut, pngOut;      // which image files
+    unsigned char *colors;   // as for generate_map_float
+    int pool;                // POOL_* mode for images and frames
+    float range;             // color range, fixed so frames compare
+    char *outFileName;       // snapshots are outFileName.step<N>, plus .grid, .bmp and .png
+    char *checkpointName;    // checkpoints replace this one file
+
+    struct GifWriter *gif;   // NULL until snapshot_animate
+    int frameW, frameH;      // animation frames are rendered this small
+    unsigned char palette[GIF_COLORS * 3]; // the color gradient, blue-low to red-high
+
+    int written;             // snapshots written, for the summary
+    int frames;              // animation frames written
+};
+
+struct SnapshotWriter *snapshot_init(int, int, int, float, float, int, int, int, int, int, int, int,
+                                     unsigned char *, int, float, char *, char *);
+int snapshot_animate(struct SnapshotWriter *, char *, int);
+void snapshot_push(struct SnapshotWriter *, float *, int, int);
+int snapshot_finish(struct SnapshotWriter *, int *);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <math.h>
+#include "stencil.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STENCIL_X86
+#include <immintrin.h>
+#endif
+
+#define STRIP_LEN 1024 // columns per pass, keeps the column sums below in L1
+
+// Every kernel here does the exact same float operations in the exact same order:
+//   col[j] = (up[j] + mid[j]) + down[j]            sum of a 3 tall column
+//   sum    = (col[j-1] + col[j+1]) + (up[j] + down[j])
+//   new    = (mid[j] + (k * sum) * 0.125) * 0.5
+// The 3 tall column sums are shared by the cell on either side of them, which
+// is where the savings over summing 8 neighbors per cell come from.
+// Sticking to one order means the SIMD widths, the scalar fallback, and the
+// perimeter cells all round identically, so which one runs never changes output.
+//
+// Kernels can also measure how much the row changed, for steady state detection.
+// The output row still holds the matrix from the step before the current one,
+// so the change is read from there just before it is overwritten, and costs no
+// extra pass over the matrix.
+
+typedef void (*RowKernel)(float *, const float *, const float *, const float *, int, float, float *, double *);
+
+void stencil_row_scalar(float *, const float *, const float *, const float *, int, float, float *, double *);
+#ifdef STENCIL_X86
+void stencil_row_sse(float *, const float *, const float *, const float *, int, float, float *, double *);
+void stencil_row_avx2(float *, const float *, const float *, const float *, int, float, float *, double *);
+void stencil_row_avx512(float *, const float *, const float *, const float *, int, float, float *, double *);
+#endif
+
+RowKernel rowKernel = NULL;
+const char *rowKernelName = "scalar";
+
+// Picks the widest kernel the running CPU supports.
+// Called from the serial part of every step function before threads start,
+// so the kernel pointer is never written while threads are reading it.
+void stencil_init(void)
+{
+    if (rowKernel)
+        return;
+
+    rowKernel = stencil_row_scalar;
+    rowKernelName = "scalar";
+
+#ifdef STENCIL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        rowKernel = stencil_row_avx512;
+        rowKernelName = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        rowKernel = stencil_row_avx2;
+        rowKernelName = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        rowKernel = stencil_row_sse;
+        rowKernelName = "sse";
+    }
+#endif
+}
+
+// Name of the kernel stencil_init picked, for reporting.
+const char *stencil_isa(void)
+{
+    stencil_init();
+    return rowKernelName;
+}
+
+// Takes output row, the rows above/at/below it, row length, and transfer rate.
+// Calculates n new cells, reading columns -1 through n of the input rows,
+// so callers either have a ghost cell there or start one cell in from the edge.
+void stencil_row(float *out, const float *up, const float *mid, const float *down, int n, float k)
+{
+    rowKernel(out, up, mid, down, n, k, NULL, NULL);
+}
+
+// Same as stencil_row, but also compares mid (the current matrix) against what out
+// held before (the previous matrix), raising maxChange to the largest absolute
+// difference and adding the squared differences to sqChange.
+// NULL maxChange/sqChange measures nothing, exactly like stencil_row.
+void stencil_row_change(float *out, const float *up, const float *mid, const float *down, int n, float k,
+                        float *maxChange, double *sqChange)
+{
+    rowKernel(out, up, mid, down, n, k, maxChange, sqChange);
+}
+
+// Takes the 9 cells of a 3x3 block, row by row, and the transfer rate.
+// Returns the new value of the center cell, rounded exactly like stencil_row.
+// Used for perimeter cells, where some of the 9 are stand-in base temperatures.
+float stencil_cell(float ul, float u, float ur, float l, float c, float r, float dl, float d, float dr, float k)
+{
+    float colLeft  = (ul + l) + dl;
+    float colRight = (ur + r) + dr;
+    float sum = (colLeft + colRight) + (u + d);
+
+    return (c + (k * sum) * 0.125f) * 0.5f;
+}
+
+void stencil_row_scalar(float *out, const float *up, const float *mid, const float *down, int n, float k,
+                        float *maxChange, double *sqChange)
+{
+    float col[STRIP_LEN + 2];
+    float maxDiff = 0;
+    float sqDiff = 0;
+
+    for (int start = 0; start < n; start += STRIP_LEN)
+    {
+        int len = n - start < STRIP_LEN ? n - start : STRIP_LEN;
+
+        // col[c] is the column sum at start - 1 + c
+        for (int c = 0; c < len + 2; c++)
+        {
+            int j = start - 1 + c;
+            col[c] = (up[j] + mid[j]) + down[j];
+        }
+
+        if (maxChange)
+        {
+            for (int c = 0; c < len; c++)
+            {
+                int j = start + c;
+                float diff = fabsf(mid[j] - out[j]);
+                maxDiff = diff > maxDiff ? diff : maxDiff;
+                sqDiff += diff * diff;
+
+                float sum = (col[c] + col[c + 2]) + (up[j] + down[j]);
+                out[j] = (mid[j] + (k * sum) * 0.125f) * 0.5f;
+            }
+            continue;
+        }
+
+        for (int c = 0; c < len; c++)
+        {
+            int j = start + c;
+            float sum = (col[c] + col[c + 2]) + (up[j] + down[j]);
+            out[j] = (mid[j] + (k * sum) * 0.125f) * 0.5f;
+        }
+    }
+
+    if (maxChange)
+    {
+        *maxChange = maxDiff > *maxChange ? maxDiff : *maxChange;
+        *sqChange += sqDiff;
+    }
+}
+
+#ifdef STENCIL_X86
+// The SIMD kernels, one per width, stamped out from stencil_kernel.h.
+// Only the intrinsics differ, AVX-512F has no andnot, so it takes abs directly.
+#define STENCIL_NAME sse
+#define STENCIL_TARGET "sse2"
+#define STENCIL_VEC __m128
+#define STENCIL_LANES 4
+#define STENCIL_LOAD _mm_loadu_ps
+#define STENCIL_STORE _mm_storeu_ps
+#define STENCIL_SET1 _mm_set1_ps
+#define STENCIL_ZERO _mm_setzero_ps
+#define STENCIL_ADD _mm_add_ps
+#define STENCIL_SUB _mm_sub_ps
+#define STENCIL_MUL _mm_mul_ps
+#define STENCIL_MAX _mm_max_ps
+#define STENCIL_ABS(v) _mm_andnot_ps(_mm_set1_ps(-0.0f), (v))
+#include "stencil_kernel.h"
+
+#define STENCIL_NAME avx2
+#define STENCIL_TARGET "avx2"
+#define STENCIL_VEC __m256
+#define STENCIL_LANES 8
+#define STENCIL_LOAD _mm256_loadu_ps
+#define STENCIL_STORE _mm256_storeu_ps
+#define STENCIL_SET1 _mm256_set1_ps
+#define STENCIL_ZERO _mm256_setzero_ps
+#define STENCIL_ADD _mm256_add_ps
+#define STENCIL_SUB _mm256_sub_ps
+#define STENCIL_MUL _mm256_mul_ps
+#define STENCIL_MAX _mm256_max_ps
+#define STENCIL_ABS(v) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), (v))
+#include "stencil_kernel.h"
+
+#define STENCIL_NAME avx512
+#define STENCIL_TARGET "avx512f"
+#define STENCIL_VEC __m512
+#define STENCIL_LANES 16
+#define STENCIL_LOAD _mm512_loadu_ps
+#define STENCIL_STORE _mm512_storeu_ps
+#define STENCIL_SET1 _mm512_set1_ps
+#define STENCIL_ZERO _mm512_setzero_ps
+#define STENCIL_ADD _mm512_add_ps
+#define STENCIL_SUB _mm512_sub_ps
+#define STENCIL_MUL _mm512_mul_ps
+#define STENCIL_MAX _mm512_max_ps
+#define STENCIL_ABS _mm512_abs_ps
+#include "stencil_kernel.h"
+#endif
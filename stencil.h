@@ -0,0 +1,11 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+void stencil_init(void);
+const char *stencil_isa(void);
+
+void stencil_row(float *, const float *, const float *, const float *, int, float);
+void stencil_row_change(float *, const float *, const float *, const float *, int, float, float *, double *);
+float stencil_cell(float, float, float, float, float, float, float, float, float, float);
+
+#endif
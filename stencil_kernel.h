@@ -0,0 +1,123 @@
+// SIMD row kernel for one instruction set, included by stencil.c once per width.
+// No include guard on purpose, each include stamps out another copy of the kernel.
+//
+// Before including, define:
+//   STENCIL_NAME    suffix for the function name, stencil_row_<name>
+//   STENCIL_TARGET  the target attribute string the kernel is compiled for
+//   STENCIL_VEC     the vector type, STENCIL_LANES floats wide
+//   STENCIL_LOAD, STENCIL_STORE, STENCIL_SET1, STENCIL_ZERO,
+//   STENCIL_ADD, STENCIL_SUB, STENCIL_MUL, STENCIL_MAX, STENCIL_ABS
+//                   the unaligned load/store and arithmetic intrinsics for that type
+//
+// This is the scalar kernel with its two inner loops widened, the scalar loops
+// finishing whatever doesn't fill a vector, so every width rounds the same.
+
+#define STENCIL_CAT_(a, b) a##_##b
+#define STENCIL_CAT(a, b) STENCIL_CAT_(a, b)
+
+__attribute__((target(STENCIL_TARGET)))
+void STENCIL_CAT(stencil_row, STENCIL_NAME)(float *out, const float *up, const float *mid, const float *down, int n,
+                                            float k, float *maxChange, double *sqChange)
+{
+    float col[STRIP_LEN + 2];
+    float maxDiff = 0;
+    float sqDiff = 0;
+    const STENCIL_VEC kv = STENCIL_SET1(k);
+    const STENCIL_VEC eighth = STENCIL_SET1(0.125f);
+    const STENCIL_VEC half = STENCIL_SET1(0.5f);
+
+    for (int start = 0; start < n; start += STRIP_LEN)
+    {
+        int len = n - start < STRIP_LEN ? n - start : STRIP_LEN;
+
+        int c = 0;
+        for (; c + STENCIL_LANES <= len + 2; c += STENCIL_LANES)
+        {
+            int j = start - 1 + c;
+            STENCIL_VEC v = STENCIL_ADD(STENCIL_LOAD(&up[j]), STENCIL_LOAD(&mid[j]));
+            STENCIL_STORE(&col[c], STENCIL_ADD(v, STENCIL_LOAD(&down[j])));
+        }
+        for (; c < len + 2; c++)
+        {
+            int j = start - 1 + c;
+            col[c] = (up[j] + mid[j]) + down[j];
+        }
+
+        c = 0;
+        if (maxChange)
+        {
+            STENCIL_VEC maxv = STENCIL_ZERO();
+            STENCIL_VEC sqv = STENCIL_ZERO();
+            for (; c + STENCIL_LANES <= len; c += STENCIL_LANES)
+            {
+                int j = start + c;
+                STENCIL_VEC midv = STENCIL_LOAD(&mid[j]);
+                STENCIL_VEC diff = STENCIL_ABS(STENCIL_SUB(midv, STENCIL_LOAD(&out[j])));
+                maxv = STENCIL_MAX(maxv, diff);
+                sqv = STENCIL_ADD(sqv, STENCIL_MUL(diff, diff));
+
+                STENCIL_VEC sum = STENCIL_ADD(STENCIL_ADD(STENCIL_LOAD(&col[c]), STENCIL_LOAD(&col[c + 2])),
+                                              STENCIL_ADD(STENCIL_LOAD(&up[j]), STENCIL_LOAD(&down[j])));
+                STENCIL_VEC v = STENCIL_MUL(STENCIL_MUL(kv, sum), eighth);
+                STENCIL_STORE(&out[j], STENCIL_MUL(STENCIL_ADD(midv, v), half));
+            }
+
+            float lanes[STENCIL_LANES];
+            STENCIL_STORE(lanes, maxv);
+            for (int l = 0; l < STENCIL_LANES; l++)
+                maxDiff = lanes[l] > maxDiff ? lanes[l] : maxDiff;
+            STENCIL_STORE(lanes, sqv);
+            for (int l = 0; l < STENCIL_LANES; l++)
+                sqDiff += lanes[l];
+
+            for (; c < len; c++)
+            {
+                int j = start + c;
+                float diff = fabsf(mid[j] - out[j]);
+                maxDiff = diff > maxDiff ? diff : maxDiff;
+                sqDiff += diff * diff;
+
+                float sum = (col[c] + col[c + 2]) + (up[j] + down[j]);
+                out[j] = (mid[j] + (k * sum) * 0.125f) * 0.5f;
+            }
+            continue;
+        }
+
+        for (; c + STENCIL_LANES <= len; c += STENCIL_LANES)
+        {
+            int j = start + c;
+            STENCIL_VEC sum = STENCIL_ADD(STENCIL_ADD(STENCIL_LOAD(&col[c]), STENCIL_LOAD(&col[c + 2])),
+                                          STENCIL_ADD(STENCIL_LOAD(&up[j]), STENCIL_LOAD(&down[j])));
+            STENCIL_VEC v = STENCIL_MUL(STENCIL_MUL(kv, sum), eighth);
+            STENCIL_STORE(&out[j], STENCIL_MUL(STENCIL_ADD(STENCIL_LOAD(&mid[j]), v), half));
+        }
+        for (; c < len; c++)
+        {
+            int j = start + c;
+            float sum = (col[c] + col[c + 2]) + (up[j] + down[j]);
+            out[j] = (mid[j] + (k * sum) * 0.125f) * 0.5f;
+        }
+    }
+
+    if (maxChange)
+    {
+        *maxChange = maxDiff > *maxChange ? maxDiff : *maxChange;
+        *sqChange += sqDiff;
+    }
+}
+
+#undef STENCIL_CAT
+#undef STENCIL_CAT_
+#undef STENCIL_NAME
+#undef STENCIL_TARGET
+#undef STENCIL_VEC
+#undef STENCIL_LANES
+#undef STENCIL_LOAD
+#undef STENCIL_STORE
+#undef STENCIL_SET1
+#undef STENCIL_ZERO
+#undef STENCIL_ADD
+#undef STENCIL_SUB
+#undef STENCIL_MUL
+#undef STENCIL_MAX
+#undef STENCIL_ABS
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "tiles.h"
+#include "heatmap.h"
+#include "png.h"
+
+int tiles_level(float *, int, int, int, float, float, unsigned char *, int, int, char *, int, int *);
+int tiles_mkdir(char *);
+
+// Takes matrix, dimensions, stride, base temperature, color range, image colors, POOL_* mode,
+// thread count, the directory to write into, and where to put the level and tile counts.
+// Writes a zoomable pyramid of TILE_SIZE square PNG tiles as dirName/z/x/y.png.
+// The deepest level draws one cell per pixel, and each level above it is pooled from
+// the one below 2x2 at a time, so the full grid is only read once. Level 0 is one tile.
+// Returns 0 on success, 1 if any directory or tile could not be written.
+int tiles_write(float *matrix, int cols, int rows, int stride, float base, float range, unsigned char *colors,
+                int pool, int numThreads, char *dirName, int *levels, int *tileCount)
+{
+    int zMax = 0;
+    while (((long)TILE_SIZE << zMax) < cols || ((long)TILE_SIZE << zMax) < rows)
+        zMax++;
+
+    // pooled levels take turns in two buffers, sized for the first two below the grid,
+    // each level only needs the one before it
+    int w1 = (cols + 1) / 2, h1 = (rows + 1) / 2;
+    float *bufs[2] = {NULL, NULL};
+    if (zMax > 0)
+        bufs[0] = (float *)malloc((size_t)w1 * h1 * sizeof(float));
+    if (zMax > 1)
+        bufs[1] = (float *)malloc((size_t)((w1 + 1) / 2) * ((h1 + 1) / 2) * sizeof(float));
+
+    int failed = (zMax > 0 && !bufs[0]) || (zMax > 1 && !bufs[1]) || tiles_mkdir(dirName);
+    int count = 0;
+
+    float *level = matrix;
+    int w = cols, h = rows, levelStride = stride;
+    for (int z = zMax; z >= 0 && !failed; z--)
+    {
+        if (z < zMax)
+        {
+            float *next = bufs[(zMax - z - 1) % 2];
+            int nextW = (w + 1) / 2, nextH = (h + 1) / 2;
+
+            pool_map_float(level, w, h, levelStride, nextW, nextH, pool, numThreads, next);
+            level = next;
+            w = nextW;
+            h = nextH;
+            levelStride = nextW;
+        }
+
+        failed = tiles_level(level, w, h, levelStride, base, range, colors, pool, numThreads, dirName, z, &count);
+    }
+
+    free(bufs[0]);
+    free(bufs[1]);
+
+    *levels = zMax + 1;
+    *tileCount = count;
+    return failed;
+}
+
+// Takes one level of the pyramid, its dimensions and stride, base temperature, color range,
+// colors, POOL_* mode, thread count, the directory, the level's zoom, and the running tile count.
+// Makes the level's directories, then draws and compresses its tiles on every thread.
+// Tiles hanging off the right or bottom of the grid are black past its edge.
+// Returns 0 on success, 1 if anything could not be written.
+int tiles_level(float *level, int w, int h, int stride, float base, float range, unsigned char *colors,
+                int pool, int numThreads, char *dirName, int z, int *count)
+{
+    int tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+    size_t nameLen = strlen(dirName) + 48;
+    int failed = 0;
+
+    char *name = (char *)malloc(nameLen);
+    sprintf(name, "%s/%d", dirName, z);
+    failed |= tiles_mkdir(name);
+    for (int x = 0; x < tilesX && !failed; x++)
+    {
+        sprintf(name, "%s/%d/%d", dirName, z, x);
+        failed |= tiles_mkdir(name);
+    }
+    free(name);
+    if (failed)
+        return 1;
+
+    #pragma omp parallel num_threads(numThreads) reduction(|:failed)
+    {
+        unsigned char *tile = (unsigned char *)malloc(TILE_SIZE * TILE_SIZE * BPP);
+        char *tileName = (char *)malloc(nameLen);
+
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < tilesX * tilesY; t++)
+        {
+            int x = t % tilesX, y = t / tilesX;
+            int tw = w - (x * TILE_SIZE) < TILE_SIZE ? w - (x * TILE_SIZE) : TILE_SIZE;
+            int th = h - (y * TILE_SIZE) < TILE_SIZE ? h - (y * TILE_SIZE) : TILE_SIZE;
+
+            if (tw < TILE_SIZE || th < TILE_SIZE)
+                memset(tile, 0, TILE_SIZE * TILE_SIZE * BPP);
+
+            // one cell per pixel, the pooling already happened between levels
+            float *corner = &level[((size_t)y * TILE_SIZE * stride) + ((size_t)x * TILE_SIZE)];
+            render_map_float(corner, tw, th, stride, tw, th, base, range, colors, pool, 1, tile, TILE_SIZE * BPP);
+
+            size_t size;
+            sprintf(tileName, "%s/%d/%d/%d.png", dirName, z, x, y);
+            failed |= png_write(tile, TILE_SIZE, TILE_SIZE, TILE_SIZE * BPP, 1, tileName, &size);
+        }
+
+        free(tile);
+        free(tileName);
+    }
+
+    *count += tilesX * tilesY;
+    return failed;
+}
+
+// Makes a directory, one that already exists is fine.
+// Returns 0 on success, 1 if it could not be made.
+int tiles_mkdir(char *path)
+{
+    return mkdir(path, 0755) && errno != EEXIST;
+}
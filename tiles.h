@@ -0,0 +1,8 @@
+#ifndef TILES_H
+#define TILES_H
+
+#define TILE_SIZE 256 // pixels per side of every tile, what web map viewers expect
+
+int tiles_write(float *, int, int, int, float, float, unsigned char *, int, int, char *, int *, int *);
+
+#endif